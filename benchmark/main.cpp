@@ -0,0 +1,92 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QFile>
+#include <QDebug>
+#include "zdictbench.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("zdictbench"));
+
+    ZDict::ZDictBenchOptions options;
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("zdict benchmarks on generated StarDict dictionaries, "
+                                                    "results are written as JSON."));
+    parser.addHelpOption();
+    const QCommandLineOption wordsOption(QStringLiteral("words"),QStringLiteral("Words in generated dictionary."),
+                                         QStringLiteral("count"),QString::number(options.wordCount));
+    const QCommandLineOption dictsOption(QStringLiteral("dicts"),QStringLiteral("Dictionaries for controller benchmarks."),
+                                         QStringLiteral("count"),QString::number(options.dictionaryCount));
+    const QCommandLineOption synonymsOption(QStringLiteral("synonyms"),QStringLiteral("Synonyms in percents of words."),
+                                            QStringLiteral("percent"),QString::number(options.synonymPercent));
+    const QCommandLineOption typesOption(QStringLiteral("types"),QStringLiteral("Article types mix, m - text, h - HTML, x - XDXF."),
+                                         QStringLiteral("type:weight,..."),options.types);
+    const QCommandLineOption iterationsOption(QStringLiteral("iterations"),QStringLiteral("Index load repeats."),
+                                              QStringLiteral("count"),QString::number(options.iterations));
+    const QCommandLineOption queriesOption(QStringLiteral("queries"),QStringLiteral("Lookups and article loads per benchmark."),
+                                           QStringLiteral("count"),QString::number(options.queries));
+    const QCommandLineOption seedOption(QStringLiteral("seed"),QStringLiteral("Generator seed."),
+                                        QStringLiteral("seed"),QString::number(options.seed));
+    const QCommandLineOption filterOption(QStringLiteral("filter"),QStringLiteral("Run benchmarks with matching names only."),
+                                          QStringLiteral("regexp"));
+    const QCommandLineOption dictionaryOption(QStringLiteral("dictionary"),QStringLiteral("Existing .ifo file for key "
+                                                                                         "compression benchmarks, "
+                                                                                         "may be repeated."),
+                                              QStringLiteral("ifo"));
+    const QCommandLineOption workdirOption(QStringLiteral("workdir"),QStringLiteral("Directory for generated dictionaries, "
+                                                                                   "temporary by default."),
+                                           QStringLiteral("path"));
+    const QCommandLineOption outputOption(QStringLiteral("output"),QStringLiteral("JSON report file, stdout by default."),
+                                          QStringLiteral("file"));
+    parser.addOptions({ wordsOption, dictsOption, synonymsOption, typesOption, iterationsOption, queriesOption,
+                        seedOption, filterOption, dictionaryOption, workdirOption, outputOption });
+    parser.process(app);
+
+    options.wordCount = qMax(1,parser.value(wordsOption).toInt());
+    options.dictionaryCount = qMax(1,parser.value(dictsOption).toInt());
+    options.synonymPercent = qMax(0,parser.value(synonymsOption).toInt());
+    options.types = parser.value(typesOption);
+    options.iterations = qMax(1,parser.value(iterationsOption).toInt());
+    options.queries = qMax(1,parser.value(queriesOption).toInt());
+    options.seed = parser.value(seedOption).toUInt();
+    options.filter.setPattern(parser.value(filterOption));
+    options.dictionaries = parser.values(dictionaryOption);
+
+    QTemporaryDir tempDir;
+    options.workDirectory = parser.isSet(workdirOption) ? parser.value(workdirOption) : tempDir.path();
+    if (options.workDirectory.isEmpty()) {
+        qCritical() << "Unable to create work directory.";
+        return 1;
+    }
+
+    ZDict::ZDictBench bench(options);
+    if (!bench.prepare()) {
+        qCritical() << "Unable to generate dictionaries.";
+        return 1;
+    }
+    bench.run();
+    const int exitCode = (bench.failures() > 0) ? 2 : 0;
+    if (exitCode != 0)
+        qCritical() << "Equivalence checks failed:" << bench.failures() << "mismatches.";
+
+    const QByteArray report = QJsonDocument(bench.report()).toJson(QJsonDocument::Indented);
+    if (!parser.isSet(outputOption)) {
+        QFile out;
+        if (!out.open(stdout,QIODevice::WriteOnly))
+            return 1;
+        out.write(report);
+        return exitCode;
+    }
+
+    QFile out(parser.value(outputOption));
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCritical() << "Unable to write report" << out.fileName();
+        return 1;
+    }
+    out.write(report);
+    return exitCode;
+}
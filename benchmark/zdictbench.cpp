@@ -0,0 +1,865 @@
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <tbb/global_control.h>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QSysInfo>
+#include <QDomDocument>
+#include <QXmlStreamReader>
+#include <QUrl>
+#include <QDebug>
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+#include "zdictcontroller.h"
+#include "internal/zstardictdictionary.h"
+#include "internal/zdictconversions.h"
+#include "internal/zdicttokenizer.h"
+#include "zdictbenchgenerator.h"
+#include "zdictbench.h"
+
+namespace {
+
+const QList<int> prefixLengths({ 1, 2, 3, 5, 8 });
+
+// Dictionary with lifecycle methods opened for benchmarks
+class ZDictBenchDictionary : public ZDict::ZStardictDictionary
+{
+public:
+    ZDictBenchDictionary() = default;
+    using ZStardictDictionary::loadInfo;
+    using ZStardictDictionary::loadIndexes;
+    using ZStardictDictionary::wordLookup;
+    using ZStardictDictionary::loadArticle;
+    using ZStardictDictionary::loadRawArticles;
+};
+
+// Edge cases for tokenizer check: ASCII punctuation, Unicode separators and case mapping, invalid UTF-8
+const QList<QByteArray> tokenizerCases({
+    "Hello, World!", "rock'n'roll", "e-mail", "C++", "AT&T", "semi;colon:pair", "tab\tseparated\nlines",
+    "  leading and trailing  ", "a--b..c", "$100 ~ 50%", "<tag>=value|x^y`z", "back\\slash", "{braces}[x]",
+    "a\x01" "b\x7f" "c", "The Quick Brown Fox Jumps Over The Lazy Dog, Again and AGAIN",
+    "SupercalifragilisticexpialidociousXYZ", "Straße", "STRASSE", "ΣΟΦΊΑ ΟΔΟΣ", "Ǆemal", "İstanbul", "ÀÉÎÕÜ",
+    "Москва—столица", "«Кавычки»", "日本語、テキスト。", "Ⅻ century", "ﬁle", "👍ok", "x\xc2\xa0" "y",
+    "x\xe2\x80\x83" "y", "x\xe3\x80\x80" "y", "x\xc2\x85" "y", "x\xe1\xa0\x8e" "y", "x\xc2\xa9" "y",
+    "x\xe2\x82\xac" "y", "x\xc2\xb4" "y", "x\xc2\xa7" "y", "x\xc3\x97" "y", "x\xe2\x88\x92" "y",
+    "\xff\xfe" "abc", "ab\xd0", "\xc0\xaf" "x", "\xed\xa0\x80" "y", "\xf4\x90\x80\x80", "caf\xe9",
+    "A\x80" "B", "Mixed Кириллица, ASCII\xe2\x80\x94and\xc2\xa0more" });
+
+// Separators joining generated words into composite headwords
+const QList<char32_t> tokenizerSeparators({ U' ', U'-', U',', U'.', U'\'', U'!', U'(', U')', U'_', U'/', U'+',
+                                            U'$', U'|', U'~', U'\t', 0x00A0, 0x2003, 0x3000, 0x2014, 0x00AB,
+                                            0x00BB, 0x3001, 0x00B7, 0x2026, 0x00A9, 0x20AC });
+
+// XDXF features not produced by the generator
+const QStringList xdxfCases({
+    QStringLiteral("<k>word</k> <kref>other <b>bold</b> ref</kref>"),
+    QStringLiteral("<c c=\"red\">colored</c> <c>plain</c> <c c=\"#00ff00\" color=\"blue\">both</c>"),
+    QStringLiteral("<ex style=\"color:red;\" id=\"e1\">styled example</ex>"),
+    QStringLiteral("<rref>sound.wav</rref><tr>[wɜːd]</tr>"),
+    QStringLiteral("<dtrn>Tom &amp; Jerry &lt;tag&gt;</dtrn>\n<kref>слово с пробелом</kref>"),
+    QStringLiteral("<def><co>nested <abr>abbr.</abr> <ex>ex <k>key</k></ex></co></def><!-- comment -->"),
+    QStringLiteral("<kref><kref>inner</kref> outer</kref>"),
+    QStringLiteral("broken <k>markup") });
+
+/* Previous QDom based xdxf2Html, reference for the equivalence check.
+ * The previous version dropped whitespace-only text and pretty printed the result, which put
+ * a line break between all sibling elements. The reference keeps source whitespace between
+ * elements and is not indented, as words are separated only where the article separates them. */
+QString xdxf2HtmlQDom(const QString& in)
+{
+    static const QList<QPair<QString,QString> > styledTags({
+        { QStringLiteral("ex"), QStringLiteral("color:#808080;") },
+        { QStringLiteral("k"), QStringLiteral("font-weight:bold;") },
+        { QStringLiteral("kref"), QString() },
+        { QStringLiteral("abr"), QStringLiteral("font-style:italic;color:#2E8B57;") },
+        { QStringLiteral("dtrn"), QStringLiteral("font-weight:bold;color:#400000;") },
+        { QStringLiteral("c"), QString() },
+        { QStringLiteral("co"), QStringLiteral("font-style:italic;color:#483D8B;") },
+        { QStringLiteral("tr"), QStringLiteral("font-weight:bold;") },
+        { QStringLiteral("rref"), QStringLiteral("display:none;") } });
+
+    QString inConverted = in;
+    inConverted.replace(u'\n',QStringLiteral("<br/>"));
+
+    QDomDocument dd;
+    if (!dd.setContent(QStringLiteral("<div>%1</div>").arg(inConverted).toUtf8(),
+                       QDomDocument::ParseOption::PreserveSpacingOnlyNodes)) {
+        return in;
+    }
+
+    // tags are renamed in the same order as before
+    for (const auto &tag : styledTags) {
+        QDomNodeList nodes = dd.elementsByTagName(tag.first);
+        while (nodes.size() > 0) {
+            QDomElement el = nodes.at(0).toElement();
+            if (tag.first == QLatin1String("kref")) {
+                el.setTagName(QStringLiteral("a"));
+                el.setAttribute(QStringLiteral("href"),QStringLiteral("zdict?word=") +
+                                QString::fromLatin1(QUrl::toPercentEncoding(el.text())));
+            } else if (tag.first == QLatin1String("c")) {
+                el.setTagName(QStringLiteral("font"));
+                if (el.hasAttribute(QStringLiteral("c"))) {
+                    el.setAttribute(QStringLiteral("color"),el.attribute(QStringLiteral("c")));
+                    el.removeAttribute(QStringLiteral("c"));
+                }
+            } else {
+                el.setTagName(QStringLiteral("span"));
+                el.setAttribute(QStringLiteral("style"),tag.second);
+            }
+        }
+    }
+
+    return dd.toString(-1);
+}
+
+/* Canonical form of XML markup for comparison: attributes sorted by name, whitespace runs in text
+ * collapsed to one space, whitespace-only text between elements is kept as a separator.
+ * Returns input as is if it is not well-formed. */
+QString canonicalXml(const QString& xml)
+{
+    QString res;
+    QXmlStreamReader reader(xml);
+    reader.setNamespaceProcessing(false);
+    QString text;
+    const QRegularExpression rxSpaces(QStringLiteral("\\s+"));
+    const auto flushText = [&res,&text,&rxSpaces]{
+        if (!text.isEmpty())
+            res.append(QStringLiteral("\"%1\"").arg(text.replace(rxSpaces,QStringLiteral(" "))));
+        text.clear();
+    };
+
+    while (!reader.atEnd()) {
+        switch (reader.readNext()) {
+            case QXmlStreamReader::StartElement: {
+                flushText();
+                QStringList attributes;
+                for (const auto &attr : reader.attributes())
+                    attributes.append(QStringLiteral("%1=\"%2\"").arg(attr.qualifiedName(),attr.value()));
+                attributes.sort();
+                res.append(QStringLiteral("<%1 %2>").arg(reader.qualifiedName(),attributes.join(u' ')));
+                break;
+            }
+            case QXmlStreamReader::EndElement:
+                flushText();
+                res.append(QStringLiteral("</%1>").arg(reader.qualifiedName()));
+                break;
+            case QXmlStreamReader::Characters:
+                text.append(reader.text());
+                break;
+            default:
+                break;
+        }
+    }
+    if (reader.hasError())
+        return xml;
+    flushText();
+    return res;
+}
+
+// Flat key layout of the previous index image (offsets + contiguous UTF-8 keys), baseline for front coding
+class ZDictBenchFlatKeys
+{
+public:
+    QByteArray arena;
+    QVector<quint32> offsets;
+
+    int count() const { return static_cast<int>(offsets.count()) - 1; }
+    QByteArrayView key(int pos) const {
+        return QByteArrayView(arena.constData() + offsets.at(pos),offsets.at(pos + 1) - offsets.at(pos));
+    }
+    qint64 memoryUsage() const {
+        return arena.size() + static_cast<qint64>(offsets.count()) * static_cast<qint64>(sizeof(quint32));
+    }
+    int lowerBound(const QByteArray& key) const {
+        return partitionPoint([this,&key](int pos){ return (this->key(pos) < key); });
+    }
+    int prefixUpperBound(const QByteArray& prefix) const {
+        return partitionPoint([this,&prefix](int pos){
+            const QByteArrayView key = this->key(pos);
+            return (key.first(qMin(key.size(),prefix.size())) <= prefix);
+        });
+    }
+
+private:
+    int partitionPoint(const std::function<bool(int)>& isBefore) const {
+        int first = 0;
+        int len = count();
+        while (len > 0) {
+            const int half = len / 2;
+            if (isBefore(first + half)) {
+                first += half + 1;
+                len -= half + 1;
+            } else {
+                len = half;
+            }
+        }
+        return first;
+    }
+};
+
+QString firstIfoFile(const QString& directory)
+{
+    const QStringList files = QDir(directory).entryList({ QStringLiteral("*.ifo") },QDir::Files,QDir::Name);
+    if (files.isEmpty())
+        return QString();
+    return QDir(directory).filePath(files.constFirst());
+}
+
+}
+
+namespace ZDict {
+
+ZDictBench::ZDictBench(const ZDictBenchOptions &options)
+    : m_options(options)
+{
+}
+
+QString ZDictBench::plainDirectory() const
+{
+    return QDir(m_options.workDirectory).filePath(QStringLiteral("plain"));
+}
+
+QString ZDictBench::compressedDirectory() const
+{
+    return QDir(m_options.workDirectory).filePath(QStringLiteral("compressed"));
+}
+
+QString ZDictBench::multiDirectory() const
+{
+    return QDir(m_options.workDirectory).filePath(QStringLiteral("multi"));
+}
+
+QString ZDictBench::cacheDirectory() const
+{
+    return QDir(m_options.workDirectory).filePath(QStringLiteral("cache"));
+}
+
+qint64 ZDictBench::residentMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile statm(QStringLiteral("/proc/self/statm"));
+    if (!statm.open(QIODevice::ReadOnly))
+        return -1;
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.count() < 2)
+        return -1;
+    return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return -1;
+#endif
+}
+
+bool ZDictBench::prepare()
+{
+    ZDictBenchGeneratorOptions options;
+    options.wordCount = m_options.wordCount;
+    options.synonymPercent = m_options.synonymPercent;
+    options.seed = m_options.seed;
+    if (!options.parseTypeWeights(m_options.types)) {
+        qWarning() << "Bench: invalid article types" << m_options.types;
+        return false;
+    }
+
+    // the same seed for both sets, so plain and compressed files have the same content
+    options.compressedIndex = false;
+    options.dictZip = false;
+    ZDictBenchGenerator plain(options);
+    if (!plain.generate(plainDirectory()))
+        return false;
+    m_words = plain.words();
+
+    options.compressedIndex = true;
+    options.dictZip = true;
+    if (!ZDictBenchGenerator(options).generate(compressedDirectory()))
+        return false;
+
+    const int multiWordCount = qMax(1,m_options.wordCount / qMax(1,m_options.dictionaryCount));
+    for (int i = 0; i < m_options.dictionaryCount; i++) {
+        ZDictBenchGeneratorOptions multi = options;
+        multi.name = QStringLiteral("bench%1").arg(i);
+        multi.wordCount = multiWordCount;
+        multi.compressedIndex = false;
+        multi.seed = m_options.seed + static_cast<quint32>(i) + 1U;
+        if (!ZDictBenchGenerator(multi).generate(multiDirectory()))
+            return false;
+    }
+
+    return QDir().mkpath(cacheDirectory());
+}
+
+bool ZDictBench::isEnabled(const QString &name) const
+{
+    if (m_options.filter.pattern().isEmpty())
+        return true;
+    return m_options.filter.match(name).hasMatch();
+}
+
+void ZDictBench::addResult(const QString &name, const QJsonObject &params, QVector<qint64> samples,
+                           const QJsonObject &metrics)
+{
+    QJsonObject res;
+    res.insert(QStringLiteral("name"),name);
+    res.insert(QStringLiteral("params"),params);
+    res.insert(QStringLiteral("iterations"),samples.count());
+    if (!samples.isEmpty()) {
+        std::sort(samples.begin(),samples.end());
+        const qsizetype count = samples.count();
+        const qint64 total = std::accumulate(samples.constBegin(),samples.constEnd(),0LL);
+        res.insert(QStringLiteral("unit"),QStringLiteral("ns"));
+        res.insert(QStringLiteral("min"),samples.constFirst());
+        res.insert(QStringLiteral("p50"),samples.at(count / 2));
+        res.insert(QStringLiteral("p99"),samples.at(qMin(count - 1,count * 99 / 100)));
+        res.insert(QStringLiteral("mean"),total / count);
+        res.insert(QStringLiteral("max"),samples.constLast());
+    }
+    if (!metrics.isEmpty())
+        res.insert(QStringLiteral("metrics"),metrics);
+    m_results.append(res);
+
+    qInfo().noquote() << QStringLiteral("%1 %2: p50 %3 ns")
+                         .arg(name,QString::fromUtf8(QJsonDocument(params).toJson(QJsonDocument::Compact)))
+                         .arg(res.value(QStringLiteral("p50")).toInteger());
+}
+
+QStringList ZDictBench::sampleWords(int count, quint32 seed) const
+{
+    QStringList res;
+    if (m_words.isEmpty())
+        return res;
+
+    QRandomGenerator random(seed);
+    res.reserve(count);
+    for (int i = 0; i < count; i++)
+        res.append(m_words.at(random.bounded(static_cast<int>(m_words.count()))));
+    return res;
+}
+
+void ZDictBench::benchIndexLoad()
+{
+    const QString name = QStringLiteral("index_load");
+    if (!isEnabled(name)) return;
+
+    const QVector<QPair<QString,QString> > datasets({ { QStringLiteral("idx"), plainDirectory() },
+                                                      { QStringLiteral("idx.gz"), compressedDirectory() } });
+    for (const auto &dataset : datasets) {
+        const QString ifoFilename = firstIfoFile(dataset.second);
+
+        // parse - IDX parsed and compiled on each load, cached - compiled index is mapped from cache
+        for (const bool cached : { false, true }) {
+            const QString cacheDir = cached ? cacheDirectory() : QString();
+            if (cached) {
+                ZDictBenchDictionary warmup;
+                warmup.setIndexCacheDirectory(cacheDir);
+                if (!warmup.loadInfo(ifoFilename) || !warmup.loadIndexes())
+                    continue;
+            }
+
+            QVector<qint64> samples;
+            QVector<qint64> memory;
+            qint64 indexBytes = 0;
+            for (int i = 0; i < m_options.iterations; i++) {
+                ZDictBenchDictionary dict;
+                dict.setIndexCacheDirectory(cacheDir);
+                if (!dict.loadInfo(ifoFilename))
+                    break;
+
+                const qint64 rss = residentMemory();
+                QElapsedTimer timer;
+                timer.start();
+                if (!dict.loadIndexes())
+                    break;
+                samples.append(timer.nsecsElapsed());
+                if (rss >= 0)
+                    memory.append(residentMemory() - rss);
+                indexBytes = dict.indexMemoryUsage();
+            }
+
+            std::sort(memory.begin(),memory.end());
+            QJsonObject metrics;
+            metrics.insert(QStringLiteral("index_bytes"),indexBytes);
+            metrics.insert(QStringLiteral("bytes_per_word"),static_cast<double>(indexBytes) / m_options.wordCount);
+            if (!memory.isEmpty())
+                metrics.insert(QStringLiteral("rss_delta_bytes"),memory.at(memory.count() / 2));
+            addResult(name,{ { QStringLiteral("index"), dataset.first },
+                             { QStringLiteral("mode"), cached ? QStringLiteral("cached") : QStringLiteral("parse") },
+                             { QStringLiteral("words"), m_options.wordCount } },samples,metrics);
+        }
+    }
+}
+
+void ZDictBench::benchIndexBuildScaling()
+{
+    const QString name = QStringLiteral("index_build_scaling");
+    if (!isEnabled(name)) return;
+
+    const QString ifoFilename = firstIfoFile(plainDirectory());
+    const int maxThreads = QThread::idealThreadCount();
+    QList<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.append(threads);
+    threadCounts.append(maxThreads);
+
+    qint64 singleThreadNs = 0;
+    for (const int threads : std::as_const(threadCounts)) {
+        // limits TBB workers behind std::execution::par
+        tbb::global_control parallelism(tbb::global_control::max_allowed_parallelism,
+                                        static_cast<size_t>(threads));
+        QVector<qint64> samples;
+        for (int i = 0; i < m_options.iterations; i++) {
+            ZDictBenchDictionary dict;
+            dict.setIndexCacheDirectory(QString());
+            if (!dict.loadInfo(ifoFilename))
+                break;
+            QElapsedTimer timer;
+            timer.start();
+            if (!dict.loadIndexes())
+                break;
+            samples.append(timer.nsecsElapsed());
+        }
+        if (samples.isEmpty())
+            continue;
+
+        QVector<qint64> sorted = samples;
+        std::sort(sorted.begin(),sorted.end());
+        const qint64 median = sorted.at(sorted.count() / 2);
+        if (threads == 1)
+            singleThreadNs = median;
+
+        QJsonObject metrics;
+        if (singleThreadNs > 0 && median > 0)
+            metrics.insert(QStringLiteral("speedup"),static_cast<double>(singleThreadNs) / median);
+        addResult(name,{ { QStringLiteral("threads"), threads },
+                         { QStringLiteral("words"), m_options.wordCount } },samples,metrics);
+    }
+}
+
+void ZDictBench::benchPrefixLookup()
+{
+    const QString name = QStringLiteral("prefix_lookup");
+    if (!isEnabled(name)) return;
+
+    ZDictBenchDictionary dict;
+    dict.setIndexCacheDirectory(QString());
+    if (!dict.loadInfo(firstIfoFile(plainDirectory())) || !dict.loadIndexes())
+        return;
+
+    const QStringList words = sampleWords(m_options.queries,m_options.seed);
+    for (const int length : prefixLengths) {
+        QVector<qint64> samples;
+        samples.reserve(words.count());
+        qint64 results = 0;
+        for (const auto &word : words) {
+            if (word.length() < length) continue;
+            const QString prefix = word.left(length);
+            QElapsedTimer timer;
+            timer.start();
+            const QStringList res = dict.wordLookup(prefix,false,defaultLookupPageSize);
+            samples.append(timer.nsecsElapsed());
+            results += res.count();
+        }
+
+        QJsonObject metrics;
+        if (!samples.isEmpty())
+            metrics.insert(QStringLiteral("avg_results"),static_cast<double>(results) / samples.count());
+        addResult(name,{ { QStringLiteral("prefix_length"), length },
+                         { QStringLiteral("page_size"), defaultLookupPageSize } },samples,metrics);
+    }
+}
+
+void ZDictBench::benchControllerLookup()
+{
+    const QString loadName = QStringLiteral("controller_load");
+    const QString lookupName = QStringLiteral("controller_lookup");
+    if (!isEnabled(loadName) && !isEnabled(lookupName)) return;
+
+    ZDictController controller;
+    controller.setIndexCacheDirectory(QString());
+    controller.setIndexLoading(ZDictController::IndexLoading::Eager);
+
+    QEventLoop loop;
+    QObject::connect(&controller,&ZDictController::dictionariesLoaded,&loop,&QEventLoop::quit,Qt::QueuedConnection);
+    QElapsedTimer timer;
+    timer.start();
+    controller.loadDictionaries({ multiDirectory() });
+    loop.exec();
+    const qint64 loadNs = timer.nsecsElapsed();
+
+    const QJsonObject params({ { QStringLiteral("dictionaries"), m_options.dictionaryCount },
+                               { QStringLiteral("words"), m_options.wordCount } });
+    if (isEnabled(loadName))
+        addResult(loadName,params,{ loadNs });
+
+    if (!isEnabled(lookupName)) return;
+
+    // words of other dictionaries, some prefixes miss, like in real input
+    const QStringList words = sampleWords(m_options.queries,m_options.seed + 1U);
+    for (const int length : prefixLengths) {
+        QVector<qint64> samples;
+        samples.reserve(words.count());
+        for (const auto &word : words) {
+            if (word.length() < length) continue;
+            const QString prefix = word.left(length);
+            timer.start();
+            controller.wordLookup(prefix,false,defaultLookupPageSize);
+            samples.append(timer.nsecsElapsed());
+        }
+        QJsonObject lookupParams = params;
+        lookupParams.insert(QStringLiteral("prefix_length"),length);
+        addResult(lookupName,lookupParams,samples);
+    }
+}
+
+void ZDictBench::benchArticleLoad()
+{
+    const QString readName = QStringLiteral("article_read");
+    const QString loadName = QStringLiteral("article_load");
+    if (!isEnabled(readName) && !isEnabled(loadName)) return;
+
+    // rendered articles cache would hide reading and rendering
+    ZDictController::setArticleCacheSize(0);
+
+    const QStringList words = sampleWords(m_options.queries,m_options.seed + 2U);
+    const QVector<QPair<QString,QString> > datasets({ { QStringLiteral("dict"), plainDirectory() },
+                                                      { QStringLiteral("dict.dz"), compressedDirectory() } });
+    for (const auto &dataset : datasets) {
+        ZDictBenchDictionary dict;
+        dict.setIndexCacheDirectory(QString());
+        if (!dict.loadInfo(firstIfoFile(dataset.second)) || !dict.loadIndexes())
+            continue;
+
+        // cold - every dictzip chunk is inflated on read, warm - default chunk cache
+        const bool compressed = dataset.first.endsWith(QStringLiteral(".dz"));
+        for (const bool chunkCache : { false, true }) {
+            if (!compressed && !chunkCache) continue;
+            ZDictController::setChunkCacheSize(chunkCache ? defaultChunkCacheSize : 0);
+
+            QJsonObject params({ { QStringLiteral("dict"), dataset.first },
+                                 { QStringLiteral("chunk_cache"), chunkCache } });
+
+            if (isEnabled(readName)) {
+                QVector<qint64> samples;
+                samples.reserve(words.count());
+                qint64 bytes = 0;
+                for (const auto &word : words) {
+                    QElapsedTimer timer;
+                    timer.start();
+                    const auto articles = dict.loadRawArticles(word);
+                    samples.append(timer.nsecsElapsed());
+                    for (const auto &article : articles)
+                        bytes += article.data.size();
+                }
+                addResult(readName,params,samples,{ { QStringLiteral("bytes"), bytes } });
+            }
+
+            if (isEnabled(loadName)) {
+                QVector<qint64> samples;
+                samples.reserve(words.count());
+                for (const auto &word : words) {
+                    QElapsedTimer timer;
+                    timer.start();
+                    dict.loadArticle(word);
+                    samples.append(timer.nsecsElapsed());
+                }
+                params.insert(QStringLiteral("types"),m_options.types);
+                addResult(loadName,params,samples);
+            }
+        }
+    }
+
+    ZDictController::setChunkCacheSize(defaultChunkCacheSize);
+    ZDictController::setArticleCacheSize(defaultArticleCacheSize);
+}
+
+QStringList ZDictBench::xdxfArticles() const
+{
+    QRandomGenerator random(m_options.seed);
+    const QStringList words = sampleWords(m_options.queries,m_options.seed + 3U);
+    QStringList res;
+    res.reserve(words.count());
+    for (const auto &word : words)
+        res.append(QString::fromUtf8(ZDictBenchGenerator::article(&random,word.toUtf8(),QChar(u'x'),30)));
+    return res;
+}
+
+void ZDictBench::benchXdxf()
+{
+    const QString name = QStringLiteral("xdxf_render");
+    if (!isEnabled(name)) return;
+
+    const QStringList articles = xdxfArticles();
+
+    // streaming converter and the previous QDom one, for the speedup
+    const QVector<QPair<QString,std::function<QString(const QString&)> > > converters({
+        { QStringLiteral("stream"), &ZDictConversions::xdxf2Html },
+        { QStringLiteral("qdom"), &xdxf2HtmlQDom } });
+    for (const auto &converter : converters) {
+        QVector<qint64> samples;
+        samples.reserve(articles.count());
+        qint64 bytes = 0;
+        qint64 totalNs = 0;
+        for (const auto &article : std::as_const(articles)) {
+            QElapsedTimer timer;
+            timer.start();
+            const QString html = converter.second(article);
+            const qint64 elapsed = timer.nsecsElapsed();
+            samples.append(elapsed);
+            totalNs += elapsed;
+            bytes += article.size() * static_cast<qint64>(sizeof(QChar));
+            Q_UNUSED(html)
+        }
+
+        QJsonObject metrics;
+        if (totalNs > 0)
+            metrics.insert(QStringLiteral("mb_per_second"),static_cast<double>(bytes) * 1000.0 / totalNs);
+        addResult(name,{ { QStringLiteral("article_words"), 30 },
+                         { QStringLiteral("converter"), converter.first } },samples,metrics);
+    }
+}
+
+void ZDictBench::checkXdxf()
+{
+    const QString name = QStringLiteral("xdxf_check");
+    if (!isEnabled(name)) return;
+
+    const QStringList articles = xdxfCases + xdxfArticles();
+    int mismatches = 0;
+    for (const auto &article : articles) {
+        const QString html = canonicalXml(ZDictConversions::xdxf2Html(article));
+        const QString expected = canonicalXml(xdxf2HtmlQDom(article));
+        if (html != expected) {
+            mismatches++;
+            qWarning() << "Bench: xdxf2Html mismatch for" << article << html << expected;
+        }
+    }
+    m_failures += mismatches;
+
+    QJsonObject metrics;
+    metrics.insert(QStringLiteral("articles"),articles.count());
+    metrics.insert(QStringLiteral("mismatches"),mismatches);
+    addResult(name,{ { QStringLiteral("reference"), QStringLiteral("qdom") } },QVector<qint64>(),metrics);
+}
+
+void ZDictBench::benchKeyCompression()
+{
+    const QString sizeName = QStringLiteral("key_compression");
+    const QString lookupName = QStringLiteral("key_lookup");
+    if (!isEnabled(sizeName) && !isEnabled(lookupName)) return;
+
+    // generated dictionary and real dictionaries from command line
+    QStringList ifoFiles({ firstIfoFile(plainDirectory()) });
+    ifoFiles.append(m_options.dictionaries);
+
+    for (const auto &ifoFilename : std::as_const(ifoFiles)) {
+        ZDictBenchDictionary dict;
+        dict.setIndexCacheDirectory(QString());
+        if (!dict.loadInfo(ifoFilename) || !dict.loadIndexes()) {
+            qWarning() << "Bench: unable to load dictionary" << ifoFilename;
+            continue;
+        }
+        const ZStardictIndex &index = dict.index();
+        if (index.isEmpty()) continue;
+
+        // full sequential decode, also rebuilds the flat baseline
+        const QString dictName = QFileInfo(ifoFilename).completeBaseName();
+        ZDictBenchFlatKeys flat;
+        QVector<qint64> scanSamples;
+        for (int i = 0; i < m_options.iterations; i++) {
+            flat.arena.clear();
+            flat.offsets.clear();
+            flat.offsets.append(0U);
+            QElapsedTimer timer;
+            timer.start();
+            ZStardictKeyCursor cursor(&index);
+            for (bool valid = cursor.seek(0); valid; valid = cursor.next()) {
+                flat.arena.append(cursor.data(),cursor.length());
+                flat.offsets.append(static_cast<quint32>(flat.arena.size()));
+            }
+            scanSamples.append(timer.nsecsElapsed());
+        }
+        if (flat.count() != index.count()) {
+            qWarning() << "Bench: front-coded keys count mismatch" << dictName;
+            m_failures++;
+            continue;
+        }
+
+        const qint64 flatBytes = flat.memoryUsage();
+        const qint64 frontCodedBytes = index.keysMemoryUsage();
+        if (isEnabled(sizeName)) {
+            QJsonObject metrics;
+            metrics.insert(QStringLiteral("keys"),index.count());
+            metrics.insert(QStringLiteral("flat_bytes"),flatBytes);
+            metrics.insert(QStringLiteral("front_coded_bytes"),frontCodedBytes);
+            metrics.insert(QStringLiteral("flat_bytes_per_key"),static_cast<double>(flatBytes) / index.count());
+            metrics.insert(QStringLiteral("front_coded_bytes_per_key"),
+                           static_cast<double>(frontCodedBytes) / index.count());
+            metrics.insert(QStringLiteral("reduction_percent"),
+                           100.0 * static_cast<double>(flatBytes - frontCodedBytes) / flatBytes);
+            addResult(sizeName,{ { QStringLiteral("dictionary"), dictName },
+                                 { QStringLiteral("block_size"), index.keyBlockSize() } },scanSamples,metrics);
+        }
+
+        if (!isEnabled(lookupName)) continue;
+
+        // prefixes of random keys, one result page is listed from each layout
+        QRandomGenerator random(m_options.seed);
+        QVector<QByteArray> sampleKeys;
+        sampleKeys.reserve(m_options.queries);
+        for (int i = 0; i < m_options.queries; i++)
+            sampleKeys.append(flat.key(random.bounded(flat.count())).toByteArray());
+
+        for (const int length : prefixLengths) {
+            QVector<qint64> flatSamples;
+            QVector<qint64> frontCodedSamples;
+            int mismatches = 0;
+            for (const auto &sampleKey : std::as_const(sampleKeys)) {
+                if (sampleKey.size() < length) continue;
+                const QByteArray prefix = sampleKey.left(length);
+
+                QElapsedTimer timer;
+                timer.start();
+                QStringList flatWords;
+                const int flatFirst = flat.lowerBound(prefix);
+                const int flatEnd = qMin(flat.prefixUpperBound(prefix),flatFirst + defaultLookupPageSize);
+                for (int pos = flatFirst; pos < flatEnd; pos++)
+                    flatWords.append(QString::fromUtf8(flat.key(pos)));
+                flatSamples.append(timer.nsecsElapsed());
+
+                timer.start();
+                QStringList frontCodedWords;
+                const int first = index.lowerBound(prefix);
+                const int end = qMin(index.prefixUpperBound(prefix),first + defaultLookupPageSize);
+                ZStardictKeyCursor cursor(&index);
+                for (bool valid = cursor.seek(first); valid && (cursor.pos() < end); valid = cursor.next())
+                    frontCodedWords.append(QString::fromUtf8(cursor.data(),cursor.length()));
+                frontCodedSamples.append(timer.nsecsElapsed());
+
+                if (flatWords != frontCodedWords)
+                    mismatches++;
+            }
+            if (mismatches > 0) {
+                qWarning() << "Bench: front-coded keys mismatch in" << dictName << "prefix length" << length;
+                m_failures++;
+            }
+
+            const QJsonObject params({ { QStringLiteral("dictionary"), dictName },
+                                       { QStringLiteral("prefix_length"), length },
+                                       { QStringLiteral("page_size"), defaultLookupPageSize } });
+            QJsonObject flatParams = params;
+            flatParams.insert(QStringLiteral("store"),QStringLiteral("flat"));
+            addResult(lookupName,flatParams,flatSamples);
+            QJsonObject frontCodedParams = params;
+            frontCodedParams.insert(QStringLiteral("store"),QStringLiteral("front_coded"));
+            frontCodedParams.insert(QStringLiteral("block_size"),index.keyBlockSize());
+            addResult(lookupName,frontCodedParams,frontCodedSamples,
+                      QJsonObject({ { QStringLiteral("mismatches"), mismatches } }));
+        }
+    }
+}
+
+void ZDictBench::checkTokenizer()
+{
+    const QString name = QStringLiteral("tokenizer_check");
+    if (!isEnabled(name)) return;
+
+    // reference splitter of the QMultiMap index
+    const QRegularExpression rxSplitter(QStringLiteral("[\\s[:punct:]]"),
+                                        QRegularExpression::UseUnicodePropertiesOption);
+
+    QList<QByteArray> headwords = tokenizerCases;
+    for (const auto &word : std::as_const(m_words))
+        headwords.append(word.toUtf8());
+
+    // composite headwords of generated words, partially uppercased
+    QRandomGenerator random(m_options.seed + 4U);
+    const QStringList words = sampleWords(m_options.queries,m_options.seed + 5U);
+    for (int i = 0; i + 3 < words.count(); i += 4) {
+        QString headword;
+        const int parts = 2 + static_cast<int>(random.bounded(3U));
+        for (int j = 0; j < parts; j++) {
+            if (j > 0) {
+                const char32_t separator = tokenizerSeparators.at(random.bounded(
+                                                                      static_cast<int>(tokenizerSeparators.count())));
+                headword.append(QString::fromUcs4(&separator,1));
+            }
+            const QString &word = words.at(i + j);
+            headword.append((random.bounded(3U) == 0U) ? word.toUpper() : word);
+        }
+        headwords.append(headword.toUtf8());
+    }
+
+    ZDictTokenizer tokenizer;
+    int mismatches = 0;
+    for (const auto &headword : std::as_const(headwords)) {
+        QByteArrayList expected;
+        const QStringList parts = QString::fromUtf8(headword).split(rxSplitter,Qt::SkipEmptyParts);
+        for (const auto &part : parts)
+            expected.append(part.toLower().toUtf8());
+
+        QByteArrayList tokens;
+        const int count = tokenizer.tokenize(headword.constData(),static_cast<int>(headword.size()));
+        for (int i = 0; i < count; i++)
+            tokens.append(QByteArray(tokenizer.tokenData(i),tokenizer.tokenLength(i)));
+
+        if (tokens != expected) {
+            mismatches++;
+            qWarning() << "Bench: tokenizer mismatch for" << headword.toHex(' ') << tokens << expected;
+        }
+    }
+    m_failures += mismatches;
+
+    QJsonObject metrics;
+    metrics.insert(QStringLiteral("headwords"),headwords.count());
+    metrics.insert(QStringLiteral("mismatches"),mismatches);
+    addResult(name,{ { QStringLiteral("reference"), rxSplitter.pattern() } },QVector<qint64>(),metrics);
+}
+
+void ZDictBench::run()
+{
+    checkTokenizer();
+    checkXdxf();
+    benchIndexLoad();
+    benchIndexBuildScaling();
+    benchPrefixLookup();
+    benchControllerLookup();
+    benchArticleLoad();
+    benchXdxf();
+    benchKeyCompression();
+}
+
+QJsonObject ZDictBench::report() const
+{
+    QJsonObject options;
+    options.insert(QStringLiteral("words"),m_options.wordCount);
+    options.insert(QStringLiteral("dictionaries"),m_options.dictionaryCount);
+    options.insert(QStringLiteral("synonym_percent"),m_options.synonymPercent);
+    options.insert(QStringLiteral("types"),m_options.types);
+    options.insert(QStringLiteral("iterations"),m_options.iterations);
+    options.insert(QStringLiteral("queries"),m_options.queries);
+    options.insert(QStringLiteral("seed"),static_cast<qint64>(m_options.seed));
+    options.insert(QStringLiteral("real_dictionaries"),QJsonArray::fromStringList(m_options.dictionaries));
+
+    QJsonObject system;
+    system.insert(QStringLiteral("qt"),QString::fromLatin1(qVersion()));
+    system.insert(QStringLiteral("os"),QSysInfo::prettyProductName());
+    system.insert(QStringLiteral("cpu_architecture"),QSysInfo::currentCpuArchitecture());
+    system.insert(QStringLiteral("threads"),QThread::idealThreadCount());
+
+    QJsonObject res;
+    res.insert(QStringLiteral("format"),1);
+    res.insert(QStringLiteral("timestamp"),QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    res.insert(QStringLiteral("system"),system);
+    res.insert(QStringLiteral("options"),options);
+    res.insert(QStringLiteral("results"),m_results);
+    return res;
+}
+
+}
@@ -0,0 +1,75 @@
+#ifndef ZDICTBENCH_H
+#define ZDICTBENCH_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QRegularExpression>
+
+namespace ZDict {
+
+class ZDictBenchOptions
+{
+public:
+    QString workDirectory;
+    int wordCount { 200000 };
+    int dictionaryCount { 4 };     // dictionaries for controller benchmarks
+    int synonymPercent { 10 };
+    QString types { QStringLiteral("m:50,h:30,x:20") };
+    int iterations { 5 };          // repeats of index load benchmarks
+    int queries { 2000 };          // lookups and article loads per benchmark
+    quint32 seed { 1U };
+    QRegularExpression filter;     // benchmark names to run, all when empty
+    QStringList dictionaries;      // existing .ifo files for key compression benchmarks
+};
+
+/* Benchmark runner, results are collected as JSON objects.
+ * Latency results have ns samples summarized as min, p50, p99, mean and max.
+ * Equivalence checks compare optimized code paths with reference implementations,
+ * mismatches are counted in failures(). */
+class ZDictBench
+{
+private:
+    ZDictBenchOptions m_options;
+    QJsonArray m_results;
+    QStringList m_words; // headwords of the single-dictionary datasets
+    int m_failures { 0 }; // mismatches found by equivalence checks
+
+    QString plainDirectory() const;
+    QString compressedDirectory() const;
+    QString multiDirectory() const;
+    QString cacheDirectory() const;
+
+    bool isEnabled(const QString& name) const;
+    void addResult(const QString& name, const QJsonObject& params, QVector<qint64> samples,
+                   const QJsonObject& metrics = QJsonObject());
+    QStringList sampleWords(int count, quint32 seed) const;
+    QStringList xdxfArticles() const; // generated XDXF articles of sample words
+
+    void benchIndexLoad();
+    void benchIndexBuildScaling();
+    void benchPrefixLookup();
+    void benchControllerLookup();
+    void benchArticleLoad();
+    void benchXdxf();
+    void benchKeyCompression();
+    void checkTokenizer();
+    void checkXdxf();
+
+public:
+    explicit ZDictBench(const ZDictBenchOptions& options);
+
+    bool prepare(); // generates dictionaries in work directory
+    void run();
+    QJsonObject report() const;
+    int failures() const { return m_failures; }
+
+    static qint64 residentMemory(); // bytes, -1 if not supported
+
+};
+
+}
+
+#endif // ZDICTBENCH_H
@@ -0,0 +1,16 @@
+QT = core xml # QtXml for the previous XDXF converter in equivalence check
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = zdictbench
+
+include(../zdict.pri)
+
+SOURCES += \
+    main.cpp \
+    zdictbench.cpp \
+    zdictbenchgenerator.cpp
+
+HEADERS += \
+    zdictbench.h \
+    zdictbenchgenerator.h
@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <iterator>
+#include <zlib.h>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+#include <QDebug>
+#include "zdictbenchgenerator.h"
+
+namespace {
+
+// letters repeated by approximate English frequency
+const char asciiLetters[] = "eeeeeeeeeeeettttttttaaaaaaaaooooooooiiiiiiinnnnnnnsssssshhhhhhrrrrrrddddlllluuu"
+                            "cccmmmwwffggyyppbbvkjxqz";
+
+const char16_t cyrillicLetters[] = u"оооооеееееаааааииииннннттттссссрррвввллллкккмммдддпппуууяяыыьь"
+                                   u"ггзббччйххжшюцщэфъё";
+
+const quint16 dictZipChunkLength = 58315U; // dictzip default, compressed chunk always fits into 16 bits
+
+QByteArray randomWord(QRandomGenerator* random, bool nonAscii)
+{
+    const int length = 2 + static_cast<int>(random->bounded(6U) + random->bounded(5U));
+    if (nonAscii) {
+        const int letters = static_cast<int>(std::size(cyrillicLetters)) - 1;
+        QString res;
+        res.reserve(length);
+        for (int i = 0; i < length; i++)
+            res.append(QChar(cyrillicLetters[random->bounded(letters)]));
+        return res.toUtf8();
+    }
+
+    const int letters = static_cast<int>(std::size(asciiLetters)) - 1;
+    QByteArray res;
+    res.reserve(length);
+    for (int i = 0; i < length; i++)
+        res.append(asciiLetters[random->bounded(letters)]);
+    return res;
+}
+
+QByteArray randomSentence(QRandomGenerator* random, int words)
+{
+    QByteArray res;
+    for (int i = 0; i < words; i++) {
+        if (i > 0)
+            res.append(' ');
+        res.append(randomWord(random,false));
+    }
+    return res;
+}
+
+void appendBigEndian(QByteArray* out, quint32 value)
+{
+    const quint32 be = qToBigEndian(value);
+    out->append(reinterpret_cast<const char*>(&be),sizeof(be));
+}
+
+void appendLittleEndian16(QByteArray* out, quint16 value)
+{
+    const quint16 le = qToLittleEndian(value);
+    out->append(reinterpret_cast<const char*>(&le),sizeof(le));
+}
+
+void appendLittleEndian32(QByteArray* out, quint32 value)
+{
+    const quint32 le = qToLittleEndian(value);
+    out->append(reinterpret_cast<const char*>(&le),sizeof(le));
+}
+
+// Runs deflate on input with flush mode, appends all output
+bool deflateAppend(z_stream* strm, const char* data, qsizetype size, int flush, QByteArray* out)
+{
+    const int outChunk = 64 * 1024;
+
+    strm->next_in = reinterpret_cast<Bytef *>(const_cast<char*>(data));
+    strm->avail_in = static_cast<uInt>(size);
+    do {
+        const qsizetype pos = out->size();
+        out->resize(pos + outChunk);
+        strm->next_out = reinterpret_cast<Bytef *>(out->data() + pos);
+        strm->avail_out = outChunk;
+        const int ret = deflate(strm,flush);
+        if (ret == Z_STREAM_ERROR)
+            return false;
+        out->resize(out->size() - strm->avail_out);
+    } while (strm->avail_out == 0);
+    return true;
+}
+
+}
+
+namespace ZDict {
+
+bool ZDictBenchGeneratorOptions::parseTypeWeights(const QString &spec)
+{
+    QVector<QPair<QChar,int> > weights;
+    for (const auto &item : spec.split(u',',Qt::SkipEmptyParts)) {
+        const QStringList pair = item.trimmed().split(u':');
+        bool ok = true;
+        const int weight = (pair.count() > 1) ? pair.at(1).toInt(&ok) : 1;
+        if (pair.first().length() != 1 || !ok || weight <= 0)
+            return false;
+        const QChar type = pair.first().at(0);
+        if (type != u'm' && type != u'h' && type != u'x')
+            return false;
+        weights.append(qMakePair(type,weight));
+    }
+    if (weights.isEmpty())
+        return false;
+
+    typeWeights = weights;
+    return true;
+}
+
+ZDictBenchGenerator::ZDictBenchGenerator(const ZDictBenchGeneratorOptions &options)
+    : m_options(options),
+      m_random(options.seed)
+{
+}
+
+QStringList ZDictBenchGenerator::words() const
+{
+    QStringList res;
+    res.reserve(m_words.count());
+    for (const auto &word : m_words)
+        res.append(QString::fromUtf8(word));
+    return res;
+}
+
+QChar ZDictBenchGenerator::randomType()
+{
+    int total = 0;
+    for (const auto &weight : std::as_const(m_options.typeWeights))
+        total += weight.second;
+
+    int value = static_cast<int>(m_random.bounded(total));
+    for (const auto &weight : std::as_const(m_options.typeWeights)) {
+        if (value < weight.second)
+            return weight.first;
+        value -= weight.second;
+    }
+    return m_options.typeWeights.constLast().first;
+}
+
+QByteArray ZDictBenchGenerator::article(QRandomGenerator *random, const QByteArray &word, QChar type, int words)
+{
+    const int length = qMax(1,words / 2 + static_cast<int>(random->bounded(words + 1)));
+    const int sentences = qMax(1,length / 8);
+    const int sentenceLength = qMax(1,length / sentences);
+
+    QByteArray res;
+    if (type == u'h') {
+        res.append("<b>").append(word).append("</b> <i>n.</i><br/><ol>");
+        for (int i = 0; i < sentences; i++)
+            res.append("<li>").append(randomSentence(random,sentenceLength)).append("</li>");
+        const QByteArray ref = randomWord(random,false);
+        res.append("</ol>see <a href=\"bword://").append(ref).append("\">").append(ref).append("</a>");
+
+    } else if (type == u'x') {
+        res.append("<k>").append(word).append("</k>\n<tr>").append(randomWord(random,false))
+                .append("</tr>\n<def><pos><abr>n.</abr></pos>");
+        for (int i = 0; i < sentences; i++) {
+            res.append("\n<dtrn>").append(randomSentence(random,sentenceLength)).append("</dtrn>");
+            if ((i % 2) == 1)
+                res.append(" <ex>").append(randomSentence(random,sentenceLength)).append("</ex>");
+        }
+        res.append("\n<co>see</co> <kref>").append(randomWord(random,false)).append("</kref></def>");
+
+    } else {
+        res.append(word).append(" -");
+        for (int i = 0; i < sentences; i++)
+            res.append("\n\t").append(randomSentence(random,sentenceLength)).append('.');
+    }
+    return res;
+}
+
+bool ZDictBenchGenerator::writeFile(const QString &filename, const QByteArray &data) const
+{
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Generator: unable to create file" << filename;
+        return false;
+    }
+    file.write(data);
+    if (!file.commit()) {
+        qWarning() << "Generator: unable to write file" << filename;
+        return false;
+    }
+    return true;
+}
+
+QByteArray ZDictBenchGenerator::gzipCompress(const QByteArray &data)
+{
+    const int gzipWindowBits = 15 + 16;
+
+    QByteArray res;
+    z_stream strm {};
+    if (deflateInit2(&strm,Z_DEFAULT_COMPRESSION,Z_DEFLATED,gzipWindowBits,8,Z_DEFAULT_STRATEGY) != Z_OK)
+        return res;
+    if (!deflateAppend(&strm,data.constData(),data.size(),Z_FINISH,&res))
+        res.clear();
+    deflateEnd(&strm);
+    return res;
+}
+
+QByteArray ZDictBenchGenerator::dictZipCompress(const QByteArray &data)
+{
+    const quint8 gzFlagExtra = 0x04U;
+    const quint8 gzOsUnix = 3U;
+    const quint16 dictZipVersion = 1U;
+    const int maxExtraLength = 65535; // 16-bit gzip extra field length
+
+    QByteArray res;
+    const qsizetype chunkCount = (data.size() + dictZipChunkLength - 1) / dictZipChunkLength;
+    const qsizetype extraLength = 10 + chunkCount * 2;
+    if (chunkCount == 0 || extraLength > maxExtraLength) {
+        qWarning() << "Generator: unsupported DICT size for dictZip" << data.size();
+        return res;
+    }
+
+    // every chunk ends with full flush, so it can be inflated separately
+    z_stream strm {};
+    if (deflateInit2(&strm,Z_BEST_COMPRESSION,Z_DEFLATED,-MAX_WBITS,8,Z_DEFAULT_STRATEGY) != Z_OK)
+        return res;
+
+    QByteArray body;
+    QVector<quint16> chunkSizes;
+    chunkSizes.reserve(chunkCount);
+    for (qsizetype pos = 0; pos < data.size(); pos += dictZipChunkLength) {
+        const qsizetype start = body.size();
+        const qsizetype size = qMin<qsizetype>(dictZipChunkLength,data.size() - pos);
+        if (!deflateAppend(&strm,data.constData() + pos,size,Z_FULL_FLUSH,&body)) {
+            deflateEnd(&strm);
+            return res;
+        }
+        chunkSizes.append(static_cast<quint16>(body.size() - start));
+    }
+    const bool finished = deflateAppend(&strm,nullptr,0,Z_FINISH,&body);
+    deflateEnd(&strm);
+    if (!finished)
+        return res;
+
+    res.reserve(12 + extraLength + body.size() + 8);
+    res.append("\x1f\x8b\x08",3);
+    res.append(static_cast<char>(gzFlagExtra));
+    appendLittleEndian32(&res,0U); // mtime, zero for reproducible output
+    res.append('\0'); // extra flags
+    res.append(static_cast<char>(gzOsUnix));
+    appendLittleEndian16(&res,static_cast<quint16>(extraLength));
+    res.append("RA",2);
+    appendLittleEndian16(&res,static_cast<quint16>(extraLength - 4));
+    appendLittleEndian16(&res,dictZipVersion);
+    appendLittleEndian16(&res,dictZipChunkLength);
+    appendLittleEndian16(&res,static_cast<quint16>(chunkCount));
+    for (const auto size : std::as_const(chunkSizes))
+        appendLittleEndian16(&res,size);
+    res.append(body);
+    appendLittleEndian32(&res,static_cast<quint32>(crc32(0L,reinterpret_cast<const Bytef *>(data.constData()),
+                                                         static_cast<uInt>(data.size()))));
+    appendLittleEndian32(&res,static_cast<quint32>(data.size()));
+    return res;
+}
+
+bool ZDictBenchGenerator::generate(const QString &directory)
+{
+    m_random.seed(m_options.seed);
+    m_words.clear();
+
+    if (!QDir().mkpath(directory)) {
+        qWarning() << "Generator: unable to create directory" << directory;
+        return false;
+    }
+
+    // headwords in StarDict order, all generated words are lowercase, so byte order is enough
+    m_words.reserve(m_options.wordCount);
+    for (int i = 0; i < m_options.wordCount; i++) {
+        const bool nonAscii = (static_cast<int>(m_random.bounded(100U)) < m_options.nonAsciiPercent);
+        m_words.append(randomWord(&m_random,nonAscii));
+    }
+    std::sort(m_words.begin(),m_words.end());
+
+    const bool singleType = (m_options.typeWeights.count() == 1);
+
+    QByteArray dict;
+    QByteArray idx;
+    for (const auto &word : std::as_const(m_words)) {
+        const QChar type = randomType();
+        const auto offset = static_cast<quint32>(dict.size());
+        if (!singleType)
+            dict.append(type.toLatin1());
+        dict.append(article(&m_random,word,type,m_options.articleWords));
+        if (!singleType)
+            dict.append('\0'); // per-article types are zero-terminated for lowercase types
+
+        idx.append(word).append('\0');
+        appendBigEndian(&idx,offset);
+        appendBigEndian(&idx,static_cast<quint32>(dict.size()) - offset);
+    }
+
+    QVector<QPair<QByteArray,quint32> > synonyms;
+    const int synonymCount = static_cast<int>(static_cast<qint64>(m_options.wordCount) * m_options.synonymPercent / 100);
+    synonyms.reserve(synonymCount);
+    for (int i = 0; (i < synonymCount) && !m_words.isEmpty(); i++) {
+        synonyms.append(qMakePair(randomWord(&m_random,false),
+                                  static_cast<quint32>(m_random.bounded(static_cast<quint32>(m_words.count())))));
+    }
+    std::sort(synonyms.begin(),synonyms.end());
+
+    QByteArray syn;
+    for (const auto &synonym : std::as_const(synonyms)) {
+        syn.append(synonym.first).append('\0');
+        appendBigEndian(&syn,synonym.second);
+    }
+
+    QDir dir(directory);
+    const QString base = dir.filePath(m_options.name);
+
+    QStringList ifo;
+    ifo.append(QStringLiteral("StarDict's dict ifo file"));
+    ifo.append(QStringLiteral("version=3.0.0"));
+    ifo.append(QStringLiteral("bookname=%1").arg(m_options.name));
+    ifo.append(QStringLiteral("wordcount=%1").arg(m_words.count()));
+    if (!synonyms.isEmpty())
+        ifo.append(QStringLiteral("synwordcount=%1").arg(synonyms.count()));
+    ifo.append(QStringLiteral("idxfilesize=%1").arg(idx.size()));
+    if (singleType)
+        ifo.append(QStringLiteral("sametypesequence=%1").arg(m_options.typeWeights.constFirst().first));
+    ifo.append(QStringLiteral("description=Synthetic benchmark dictionary, seed %1").arg(m_options.seed));
+
+    const QByteArray idxData = m_options.compressedIndex ? gzipCompress(idx) : idx;
+    const QByteArray dictData = m_options.dictZip ? dictZipCompress(dict) : dict;
+    if (idxData.isEmpty() || dictData.isEmpty())
+        return false;
+
+    // stale files of the other variant would be picked up by the dictionary loader
+    for (const auto &suffix : { "idx", "idx.gz", "syn", "dict", "dict.dz" })
+        QFile::remove(QStringLiteral("%1.%2").arg(base,QLatin1String(suffix)));
+
+    m_ifoFilename = QStringLiteral("%1.ifo").arg(base);
+    if (!writeFile(m_ifoFilename,ifo.join(u'\n').append(u'\n').toUtf8()))
+        return false;
+    if (!writeFile(QStringLiteral("%1.%2").arg(base,m_options.compressedIndex ? QStringLiteral("idx.gz")
+                                                                              : QStringLiteral("idx")),idxData))
+        return false;
+    if (!syn.isEmpty() && !writeFile(QStringLiteral("%1.syn").arg(base),syn))
+        return false;
+    return writeFile(QStringLiteral("%1.%2").arg(base,m_options.dictZip ? QStringLiteral("dict.dz")
+                                                                       : QStringLiteral("dict")),dictData);
+}
+
+}
@@ -0,0 +1,59 @@
+#ifndef ZDICTBENCHGENERATOR_H
+#define ZDICTBENCHGENERATOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <QPair>
+#include <QRandomGenerator>
+
+namespace ZDict {
+
+class ZDictBenchGeneratorOptions
+{
+public:
+    QString name { QStringLiteral("bench") };
+    int wordCount { 100000 };
+    int synonymPercent { 0 };       // synonyms count in percents of word count, written to .syn
+    int nonAsciiPercent { 10 };     // headwords with Cyrillic letters
+    int articleWords { 30 };        // average article length in words
+    QVector<QPair<QChar,int> > typeWeights { { QChar(u'm'), 1 } }; // article types, single type uses sametypesequence
+    bool compressedIndex { false }; // .idx.gz instead of .idx
+    bool dictZip { true };          // .dict.dz instead of .dict
+    quint32 seed { 1U };
+
+    ZDictBenchGeneratorOptions() = default;
+    bool parseTypeWeights(const QString& spec); // "m:60,h:25,x:15"
+};
+
+/* Writes reproducible synthetic StarDict dictionaries.
+ * The same options and seed produce byte-identical files. */
+class ZDictBenchGenerator
+{
+private:
+    ZDictBenchGeneratorOptions m_options;
+    QRandomGenerator m_random;
+    QVector<QByteArray> m_words;
+    QString m_ifoFilename;
+
+    QChar randomType();
+    bool writeFile(const QString& filename, const QByteArray& data) const;
+    static QByteArray gzipCompress(const QByteArray& data);
+    static QByteArray dictZipCompress(const QByteArray& data);
+
+public:
+    explicit ZDictBenchGenerator(const ZDictBenchGeneratorOptions& options);
+
+    bool generate(const QString& directory);
+    QString ifoFilename() const { return m_ifoFilename; }
+    QStringList words() const; // headwords in index order
+
+    // Article body of given StarDict type ('m', 'h' or 'x'), about words long
+    static QByteArray article(QRandomGenerator* random, const QByteArray& word, QChar type, int words);
+
+};
+
+}
+
+#endif // ZDICTBENCHGENERATOR_H
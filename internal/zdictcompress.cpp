@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <numeric>
+#include <cerrno>
+#include <unistd.h>
 #include <QDebug>
 
 extern "C" {
@@ -7,53 +11,172 @@ extern "C" {
 #include "zdictcompress.h"
 #include "zdictionary.h"
 
-namespace ZDict {
+namespace {
 
-QByteArray gzInflate(const QByteArray &src)
+bool readAt(QFile* file, quint64 offset, char* data, qint64 size)
 {
-    QByteArray res;
+    const int fd = file->handle();
+    if (fd < 0) return false;
+
+    qint64 done = 0;
+    while (done < size) {
+        const ssize_t ret = ::pread(fd,data + done,static_cast<size_t>(size - done),
+                                    static_cast<off_t>(offset + done));
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (ret == 0) return false;
+        done += ret;
+    }
+    return true;
+}
 
-    const unsigned int chunkSize = 1024;
-    char buf[chunkSize] = {}; // NOLINT
+}
 
-    z_stream strm;
-    int ret = 0;
+namespace ZDict {
 
-    strm.zalloc = nullptr;
-    strm.zfree = nullptr;
-    strm.opaque = nullptr;
-    strm.avail_in = src.size();
-    strm.next_in = reinterpret_cast<uchar*>(const_cast<char*>(src.constData()));
+/* Streaming gzip/zlib inflater, reads compressed data from device in small chunks,
+ * so the whole compressed file is never held in memory. */
+class ZGzipInflater
+{
+private:
+    QIODevice* m_source { nullptr };
+    z_stream m_strm {};
+    bool m_streamInitialized { false };
+    bool m_finished { false };
+    bool m_error { false };
+    QByteArray m_inBuffer;
+
+public:
+    explicit ZGzipInflater(QIODevice* source);
+    ~ZGzipInflater();
+    ZGzipInflater(const ZGzipInflater& other) = delete;
+    ZGzipInflater& operator = (const ZGzipInflater &t) = delete;
+
+    bool atEnd() const { return m_finished || m_error; }
+    bool hasError() const { return m_error; }
+    // Inflates up to size bytes into data, returns inflated length, 0 at end of stream, -1 on error
+    qsizetype inflate(char* data, qsizetype size);
+};
+
+class ZDictZipReader
+{
+private:
+    QFile* m_file { nullptr };
+    const DictFileData* m_fileData { nullptr };
+    z_stream m_strm {};
+    bool m_streamInitialized { false };
+    QByteArray m_inBuffer;
+    unsigned int m_lastChunkIndex { 0U };
+    QByteArray m_lastChunk;
+
+    bool chunk(unsigned int index, QByteArray* data);
+
+public:
+    ZDictZipReader(QFile* file, const DictFileData* fileData);
+    ~ZDictZipReader();
+    ZDictZipReader(const ZDictZipReader& other) = delete;
+    ZDictZipReader& operator = (const ZDictZipReader &t) = delete;
+
+    QByteArray read(quint64 start, quint32 size);
+};
+
+ZGzipInflater::ZGzipInflater(QIODevice *source)
+    : m_source(source)
+{
+    m_strm.zalloc = nullptr;
+    m_strm.zfree = nullptr;
+    m_strm.opaque = nullptr;
+    m_strm.avail_in = 0;
+    m_strm.next_in = nullptr;
+
+    // gzip or zlib header autodetection
+    m_error = (inflateInit2(&m_strm, 15+32) != Z_OK);
+    m_streamInitialized = !m_error;
+}
 
-    ret = inflateInit2(&strm, 15+32);
-    if (ret != Z_OK)
-        return res;
+ZGzipInflater::~ZGzipInflater()
+{
+    if (m_streamInitialized)
+        inflateEnd(&m_strm);
+}
 
-    do {
-        strm.avail_out = chunkSize;
-        strm.next_out = reinterpret_cast<uchar*>(buf);
-        ret = inflate(&strm,Z_NO_FLUSH);
+qsizetype ZGzipInflater::inflate(char *data, qsizetype size)
+{
+    const qsizetype inputChunkSize = 256 * 1024;
+
+    if (m_error) return -1;
+    if (m_finished || size <= 0) return 0;
+
+    m_strm.avail_out = static_cast<uInt>(size);
+    m_strm.next_out = reinterpret_cast<uchar*>(data);
+
+    while (m_strm.avail_out > 0) {
+        if (m_strm.avail_in == 0) {
+            if (m_inBuffer.size() != inputChunkSize)
+                m_inBuffer.resize(inputChunkSize);
+            const qint64 len = m_source->read(m_inBuffer.data(),inputChunkSize);
+            if (len < 0) {
+                m_error = true;
+                return -1;
+            }
+            if (len == 0) { // truncated stream, keep what we have
+                m_finished = true;
+                break;
+            }
+            m_strm.avail_in = static_cast<uInt>(len);
+            m_strm.next_in = reinterpret_cast<uchar*>(m_inBuffer.data());
+        }
 
-        switch (ret) {
-        case Z_NEED_DICT:
-        case Z_DATA_ERROR:
-        case Z_MEM_ERROR:
-            inflateEnd(&strm);
-            return QByteArray();
-        default:
+        const int ret = ::inflate(&m_strm,Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            m_finished = true;
             break;
         }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            m_error = true;
+            return -1;
+        }
+    }
 
-        res.append(buf, static_cast<int>(chunkSize - strm.avail_out));
-    } while (strm.avail_out == 0);
+    return size - static_cast<qsizetype>(m_strm.avail_out);
+}
 
-    inflateEnd(&strm);
+QByteArray gzInflate(QIODevice *src, qsizetype sizeHint)
+{
+    const qsizetype minGrowth = 1024 * 1024;
+
+    ZGzipInflater inflater(src);
+    // inflate directly into the result buffer, presized by caller hint,
+    // one spare byte lets inflate report end of stream without growing exactly sized buffer
+    QByteArray res(qMax(sizeHint + 1,minGrowth),Qt::Uninitialized);
+    qsizetype filled = 0;
+
+    while (!inflater.atEnd()) {
+        if (filled == res.size())
+            res.resize(res.size() + qMax(res.size() / 2,minGrowth));
+
+        const qsizetype len = inflater.inflate(res.data() + filled,res.size() - filled);
+        if (len < 0)
+            return QByteArray();
+        filled += len;
+    }
 
+    res.truncate(filled); // capacity is kept, appending terminator doesn't reallocate
     return res;
 }
 
+ZDictChunkCache& dictZipChunkCache()
+{
+    static ZDictChunkCache cache(defaultChunkCacheSize);
+    return cache;
+}
+
 bool dictZipInitialize(QFile* dz, DictFileData* fileData)
 {
+    static QAtomicInteger<quint64> lastCacheId;
+
     fileData->clear();
 
     const QByteArray GZ_MAGIC = QByteArrayLiteral("\x1f\x8b"); // NOLINT
@@ -90,7 +213,7 @@ bool dictZipInitialize(QFile* dz, DictFileData* fileData)
 
     // skip remained header
     dz->skip(6); // NOLINT
-    qint16 extraLength = 0;
+    quint16 extraLength = 0U;
     dz->read(reinterpret_cast<char*>(&extraLength),sizeof(extraLength));
 
     fileData->headerLength = GZ_XLEN - 1 + extraLength + 2;
@@ -106,13 +229,13 @@ bool dictZipInitialize(QFile* dz, DictFileData* fileData)
     dz->read(reinterpret_cast<char*>(&(fileData->chunkLength)),sizeof(fileData->chunkLength));
     dz->read(reinterpret_cast<char*>(&(fileData->chunkCount)),sizeof(fileData->chunkCount));
 
-    if (fileData->chunkCount <= 0) {
+    if ((fileData->chunkCount == 0U) || (fileData->chunkLength == 0U)) {
         qWarning() << "DictZIP: broken dictZip file (no chunks).";
         return false;
     }
 
     for (int i=0; i<fileData->chunkCount; i++) {
-        qint16 chunk = 0;
+        quint16 chunk = 0U;
         dz->read(reinterpret_cast<char*>(&chunk),sizeof(chunk));
         fileData->chunks.append(chunk);
     }
@@ -163,98 +286,176 @@ bool dictZipInitialize(QFile* dz, DictFileData* fileData)
     }
 
     fileData->isDictZip = true;
+    fileData->cacheId = lastCacheId.fetchAndAddRelaxed(1U) + 1U;
 
     return true;
 }
 
-QByteArray dictZipRead(QFile* dz, DictFileData* fileData, quint64 start, quint32 size)
+ZDictZipReader::ZDictZipReader(QFile *file, const DictFileData *fileData)
+    : m_file(file),
+      m_fileData(fileData)
 {
-    const unsigned int IN_BUFFER_SIZE = 60000;
+}
 
-    QByteArray res;
+ZDictZipReader::~ZDictZipReader()
+{
+    if (m_streamInitialized)
+        inflateEnd(&m_strm);
+}
 
-    if (!dz->isOpen())
-        return res;
+bool ZDictZipReader::chunk(unsigned int index, QByteArray *data)
+{
+    const unsigned int IN_BUFFER_SIZE = 0x10000U; // inflated chunk is at most 16-bit chunkLength
 
-    if (!fileData->isDictZip) {
-        dz->seek(start);
-        return dz->read(size);
+    if (!m_lastChunk.isEmpty() && (m_lastChunkIndex == index)) {
+        *data = m_lastChunk;
+        return true;
     }
 
-    z_stream strm;
-    int ret = 0;
+    // every dictzip chunk is a separately flushed deflate block, chunks are cached independently
+    const auto cacheKey = qMakePair(m_fileData->cacheId,index);
+    if (!dictZipChunkCache().find(cacheKey,data)) {
+        if (index >= static_cast<unsigned int>(m_fileData->chunks.count())) {
+            qWarning() << "DictZIP: chunk index out of range";
+            return false;
+        }
+        const quint16 chunkSize = m_fileData->chunks.at(static_cast<int>(index));
+        quint64 chunkOffset = m_fileData->offsets.at(static_cast<int>(index));
 
-    strm.zalloc = nullptr;
-    strm.zfree = nullptr;
-    strm.opaque = nullptr;
-    strm.avail_in = 0U;
-    strm.next_in = nullptr;
-    strm.avail_out = 0U;
-    strm.next_out = nullptr;
+        QByteArray outBuffer(chunkSize,Qt::Uninitialized);
+        if (!readAt(m_file,chunkOffset,outBuffer.data(),chunkSize)) {
+            qWarning() << "DictZIP: chunk read error";
+            return false;
+        }
 
-    ret = inflateInit2(&strm, -15);
-    if (ret != Z_OK)
-        return res;
+        if (!m_streamInitialized) {
+            if (inflateInit2(&m_strm, -15) != Z_OK)
+                return false;
+            m_streamInitialized = true;
+            m_inBuffer.resize(IN_BUFFER_SIZE);
+        } else {
+            inflateReset(&m_strm);
+        }
 
-    quint64 end = start + size;
+        m_strm.next_in   = reinterpret_cast<Bytef *>(outBuffer.data());
+        m_strm.avail_in  = chunkSize;
+        m_strm.next_out  = reinterpret_cast<Bytef *>(m_inBuffer.data());
+        m_strm.avail_out = IN_BUFFER_SIZE;
+        if (inflate(&m_strm,  Z_PARTIAL_FLUSH ) != Z_OK) {
+            qWarning() << ZDQSL("DictZIP: zlib inflate error: %1").arg(QString::fromUtf8(m_strm.msg));
+            return false;
+        }
+        if (m_strm.avail_in > 0) {
+            qWarning() << ZDQSL("DictZIP: inflate did not flush (%1 pending, %2 avail)")
+                          .arg(m_strm.avail_in).arg(m_strm.avail_out);
+            return false;
+        }
 
-    unsigned int firstChunk  = start / fileData->chunkLength;
-    unsigned int firstOffset = start - firstChunk * fileData->chunkLength;
-    unsigned int lastChunk   = end / fileData->chunkLength;
-    unsigned int lastOffset  = end - lastChunk * fileData->chunkLength;
+        unsigned int count = IN_BUFFER_SIZE - m_strm.avail_out;
+        if (metrics().isEnabled())
+            metrics().addDictZipInflated(count);
+        *data = QByteArray(m_inBuffer.constData(),static_cast<int>(count));
+        dictZipChunkCache().insert(cacheKey,*data,data->size());
+    }
 
-    QByteArray inBuffer(IN_BUFFER_SIZE, 0x0);
+    m_lastChunkIndex = index;
+    m_lastChunk = *data;
+    return true;
+}
 
-    for (unsigned int i=firstChunk; i <= lastChunk; i++) {
-        qint16 chunkSize = fileData->chunks.at(static_cast<int>(i));
-        quint64 chunkOffset = fileData->offsets.at(static_cast<int>(i));
+QByteArray ZDictZipReader::read(quint64 start, quint32 size)
+{
+    QByteArray res;
 
-        dz->seek(chunkOffset);
-        QByteArray outBuffer = dz->read(chunkSize);
-        if (outBuffer.size() != chunkSize) {
-            qWarning() << "DictZIP: chunk read error";
-            res.clear();
-            break;
+    if (!m_fileData->isDictZip) {
+        if (m_fileData->mapped != nullptr) {
+            // zero-copy view, valid while the dictionary keeps its mapping
+            if ((start + size) > static_cast<quint64>(m_fileData->mappedSize))
+                return res;
+            return QByteArray::fromRawData(reinterpret_cast<const char*>(m_fileData->mapped + start),
+                                           static_cast<int>(size));
         }
-
-        strm.next_in   = reinterpret_cast<Bytef *>(outBuffer.data());
-        strm.avail_in  = chunkSize;
-        strm.next_out  = reinterpret_cast<Bytef *>(inBuffer.data());
-        strm.avail_out = IN_BUFFER_SIZE;
-        if (inflate(&strm,  Z_PARTIAL_FLUSH ) != Z_OK) {
-            qWarning() << ZDQSL("DictZIP: zlib inflate error: %1").arg(QString::fromUtf8(strm.msg));
+        res.resize(static_cast<int>(size));
+        if (!readAt(m_file,start,res.data(),size))
             res.clear();
-            break;
-        }
-        if (strm.avail_in > 0) {
-            qWarning() << ZDQSL("DictZIP: inflate did not flush (%1 pending, %2 avail)")
-                          .arg(strm.avail_in).arg(strm.avail_out);
+        return res;
+    }
+
+    if (size == 0U)
+        return res;
+
+    // end is exclusive, a range ending on a chunk boundary doesn't touch the next chunk
+    quint64 end = start + size;
+
+    unsigned int firstChunk  = start / m_fileData->chunkLength;
+    unsigned int firstOffset = start - firstChunk * m_fileData->chunkLength;
+    unsigned int lastChunk   = (end - 1U) / m_fileData->chunkLength;
+    unsigned int lastOffset  = end - lastChunk * m_fileData->chunkLength;
+
+    res.reserve(static_cast<int>(size));
+
+    const auto appendSlice = [&res](const QByteArray& chunk, unsigned int from, unsigned int length){
+        const auto chunkSize = static_cast<unsigned int>(chunk.size());
+        from = qMin(from,chunkSize);
+        length = qMin(length,chunkSize - from);
+        res.append(chunk.constData() + from,static_cast<int>(length));
+    };
+
+    for (unsigned int i=firstChunk; i <= lastChunk; i++) {
+        QByteArray chunkData;
+        if (!chunk(i,&chunkData)) {
             res.clear();
             break;
         }
 
-        unsigned int count = IN_BUFFER_SIZE - strm.avail_out;
-
         if (i == firstChunk) {
             if (i == lastChunk) {
-                res.append(inBuffer.mid(static_cast<int>(firstOffset),
-                                        static_cast<int>(lastOffset - firstOffset)));
+                appendSlice(chunkData,firstOffset,lastOffset - firstOffset);
             } else {
-                if (count != fileData->chunkLength) {
+                if (chunkData.size() != m_fileData->chunkLength) {
                     qWarning() << ZDQSL("DictZIP: Length = %1 instead of %2")
-                                  .arg(count).arg(fileData->chunkLength);
+                                  .arg(chunkData.size()).arg(m_fileData->chunkLength);
                 }
-                res.append(inBuffer.mid(static_cast<int>(firstOffset),
-                                        static_cast<int>(fileData->chunkLength - firstOffset)));
+                appendSlice(chunkData,firstOffset,m_fileData->chunkLength - firstOffset);
             }
         } else if (i == lastChunk) {
-            res.append(inBuffer.mid(0,static_cast<int>(lastOffset)));
+            appendSlice(chunkData,0U,lastOffset);
         } else {
-            res.append(inBuffer.mid(0,static_cast<int>(fileData->chunkLength)));
+            appendSlice(chunkData,0U,m_fileData->chunkLength);
         }
     }
 
-    inflateEnd(&strm);
+    return res;
+}
+
+QByteArray dictZipRead(QFile* dz, const DictFileData* fileData, quint64 start, quint32 size)
+{
+    if (!dz->isOpen())
+        return QByteArray();
+
+    ZDictZipReader reader(dz,fileData);
+    return reader.read(start,size);
+}
+
+QVector<QByteArray> dictZipReadBatch(QFile* dz, const DictFileData* fileData,
+                                     const QVector<QPair<quint64,quint32> > &ranges)
+{
+    QVector<QByteArray> res(ranges.count());
+    if (!dz->isOpen())
+        return res;
+
+    // read in file order, so neighbouring articles reuse the last inflated chunk
+    QVector<int> order(ranges.count());
+    std::iota(order.begin(),order.end(),0);
+    std::stable_sort(order.begin(),order.end(),[&ranges](int a, int b){
+        return (ranges.at(a).first < ranges.at(b).first);
+    });
+
+    ZDictZipReader reader(dz,fileData);
+    for (const int idx : std::as_const(order)) {
+        const auto &range = ranges.at(idx);
+        res[idx] = reader.read(range.first,range.second);
+    }
 
     return res;
 }
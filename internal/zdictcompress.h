@@ -2,35 +2,55 @@
 #define ZDICTCOMPRESS_H
 
 #include <QByteArray>
+#include <QIODevice>
 #include <QFile>
+#include <QPair>
+#include <QVector>
+#include "zdictlrucache.h"
 
 namespace ZDict {
 
-QByteArray gzInflate(const QByteArray &src);
+// sizeHint - expected uncompressed size, result buffer is allocated once when hint is exact
+QByteArray gzInflate(QIODevice* src, qsizetype sizeHint = 0);
 
 class DictFileData
 {
 public:
     bool isDictZip { false };
+    quint64 cacheId { 0U };
+    const uchar* mapped { nullptr }; // whole plain DICT file mapping, owned by dictionary QFile
+    qint64 mappedSize { 0L };
     qint64 headerLength { 0L };
     quint16 chunkLength { 0U };
-    qint16 chunkCount { 0 };
-    QList<qint16> chunks;
+    quint16 chunkCount { 0U };
+    QList<quint16> chunks;
     QList<quint64> offsets;
 
     DictFileData() = default;
     void clear() {
         isDictZip = false;
+        cacheId = 0U;
+        mapped = nullptr;
+        mappedSize = 0L;
         headerLength = 0;
         chunkLength = 0;
-        chunkCount = 0;
+        chunkCount = 0U;
         chunks.clear();
         offsets.clear();
     };
 };
 
+using ZDictChunkCache = ZDictLruCache<QPair<quint64,quint32>,QByteArray>; // (cacheId, chunk) -> inflated chunk
+
+const qint64 defaultChunkCacheSize = 32 * 1024 * 1024;
+
+ZDictChunkCache& dictZipChunkCache();
 bool dictZipInitialize(QFile* dz, DictFileData* fileData);
-QByteArray dictZipRead(QFile* dz, DictFileData* fileData, quint64 start, quint32 size);
+// Thread-safe: uses positional reads and does not touch the QFile position
+QByteArray dictZipRead(QFile* dz, const DictFileData* fileData, quint64 start, quint32 size);
+// Reads (offset,size) ranges in file order, each chunk is inflated once per batch. Result is aligned with ranges.
+QVector<QByteArray> dictZipReadBatch(QFile* dz, const DictFileData* fileData,
+                                     const QVector<QPair<quint64,quint32> >& ranges);
 
 }
 
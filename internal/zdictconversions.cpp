@@ -4,124 +4,248 @@
  *   (c) 2008-2011 Konstantin Isakov <ikm@users.berlios.de>
  */
 
-#include <QDomDocument>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+#include <QVector>
 #include <QUrl>
 #include "zdictconversions.h"
 #include "zdictionary.h"
 #include <QDebug>
 
-QString ZDictConversions::htmlPreformat(const QString & str)
-{
-    QString result = str.toHtmlEscaped();
-    result.replace(u'\t',ZDQSL("&emsp;"));
-    result.replace(u'\n',ZDQSL("<br/>"));
-    result.remove(u'\r');
-
-    return result;
-}
+namespace {
 
-QString ZDictConversions::xdxf2Html(const QString& in)
+class XdxfEvent
+{
+public:
+    QXmlStreamReader::TokenType type { QXmlStreamReader::NoToken };
+    QString name;
+    QXmlStreamAttributes attributes;
+    QString text;
+};
+
+QString xdxfElementStyle(const QString& name)
 {
     static const QHash<QString,QString> articleStyles = {
-        { ZDQSL("example"),   ZDQSL("color:#808080;") },
-        { ZDQSL("key"),       ZDQSL("font-weight:bold;") },
-        { ZDQSL("abbrev"),    ZDQSL("font-style:italic;color:#2E8B57;") },
-        { ZDQSL("editorial"), ZDQSL("font-style:italic;color:#483D8B;") },
-        { ZDQSL("dtrn"),      ZDQSL("font-weight:bold;color:#400000;") },
-        { ZDQSL("tr"),        ZDQSL("font-weight:bold;") }
+        { ZDQSL("ex"),   ZDQSL("color:#808080;") },                    // Example
+        { ZDQSL("k"),    ZDQSL("font-weight:bold;") },                 // Key
+        { ZDQSL("abr"),  ZDQSL("font-style:italic;color:#2E8B57;") },  // Abbreviation
+        { ZDQSL("co"),   ZDQSL("font-style:italic;color:#483D8B;") },  // Editorial comment
+        { ZDQSL("dtrn"), ZDQSL("font-weight:bold;color:#400000;") },   // Direct translation
+        { ZDQSL("tr"),   ZDQSL("font-weight:bold;") },                 // Transcription
+        { ZDQSL("rref"), ZDQSL("display:none;") }                      // Resource reference
     };
 
-    QString inConverted = in;
-    inConverted.replace('\n',ZDQSL("<br/>"));
-
-    QDomDocument dd;
-    auto parseResult = dd.setContent(ZDQSL("<div>%1</div>").arg(inConverted).toUtf8());
-    if (!parseResult)
-    {
-        qWarning() << "Xdxf2html error, xml parse failed: " << parseResult.errorMessage << " at "
-                   << parseResult.errorLine << parseResult.errorColumn;
-        qWarning() << "The input was: " << inConverted;
-        return in;
-    }
+    return articleStyles.value(name);
+}
 
-    QDomNodeList nodes = dd.elementsByTagName(ZDQSL("ex")); // Example
-    while (nodes.size()>0) {
-        QDomElement el = nodes.at(0).toElement();
-        el.setTagName(ZDQSL("span"));
-        QString style = articleStyles.value(ZDQSL("example"));
-        if (!style.isEmpty())
-            el.setAttribute(ZDQSL("style"), style);
+void writeXdxfEvent(QXmlStreamWriter* writer, const XdxfEvent& event, const QString& krefText)
+{
+    switch (event.type) {
+        case QXmlStreamReader::StartElement: {
+            if (event.name == QLatin1String("kref")) { // Reference to another word
+                writer->writeStartElement(ZDQSL("a"));
+                for (const auto &attr : event.attributes) {
+                    if (attr.qualifiedName() != QLatin1String("href"))
+                        writer->writeAttribute(attr.qualifiedName().toString(),attr.value().toString());
+                }
+                writer->writeAttribute(ZDQSL("href"),ZDQSL("zdict?word=%1")
+                                       .arg(QString::fromLatin1(QUrl::toPercentEncoding(krefText))));
+
+            } else if (event.name == QLatin1String("c")) { // Color
+                writer->writeStartElement(ZDQSL("font"));
+                const bool hasColor = event.attributes.hasAttribute(ZDQSL("c"));
+                for (const auto &attr : event.attributes) {
+                    if (attr.qualifiedName() != QLatin1String("c") &&
+                            (!hasColor || attr.qualifiedName() != QLatin1String("color")))
+                        writer->writeAttribute(attr.qualifiedName().toString(),attr.value().toString());
+                }
+                if (hasColor)
+                    writer->writeAttribute(ZDQSL("color"),event.attributes.value(ZDQSL("c")).toString());
+
+            } else {
+                const QString style = xdxfElementStyle(event.name);
+                if (style.isEmpty()) {
+                    writer->writeStartElement(event.name);
+                    writer->writeAttributes(event.attributes);
+                } else {
+                    writer->writeStartElement(ZDQSL("span"));
+                    for (const auto &attr : event.attributes) {
+                        if (attr.qualifiedName() != QLatin1String("style"))
+                            writer->writeAttribute(attr.qualifiedName().toString(),attr.value().toString());
+                    }
+                    writer->writeAttribute(ZDQSL("style"),style);
+                }
+            }
+            break;
+        }
+        case QXmlStreamReader::EndElement:
+            writer->writeEndElement();
+            break;
+        case QXmlStreamReader::Characters:
+            writer->writeCharacters(event.text);
+            break;
+        case QXmlStreamReader::Comment:
+            writer->writeComment(event.text);
+            break;
+        case QXmlStreamReader::ProcessingInstruction:
+            writer->writeProcessingInstruction(event.name,event.text);
+            break;
+        default:
+            break;
     }
+}
 
-    nodes = dd.elementsByTagName(ZDQSL("k")); // Key
-    while (nodes.size()>0) {
-        QDomElement el = nodes.at(0).toElement();
-        el.setTagName(ZDQSL("span"));
-        QString style = articleStyles.value(ZDQSL("key"));
-        if (!style.isEmpty())
-            el.setAttribute(ZDQSL("style"), style);
+// Writes buffered kref subtree, href of each kref is built from its whole text
+void writeXdxfEvents(QXmlStreamWriter* writer, const QVector<XdxfEvent>& events)
+{
+    for (int i = 0; i < events.count(); i++) {
+        const XdxfEvent &event = events.at(i);
+        QString krefText;
+        if (event.type == QXmlStreamReader::StartElement && event.name == QLatin1String("kref")) {
+            int depth = 0;
+            for (int j = i; j < events.count(); j++) {
+                const XdxfEvent &inner = events.at(j);
+                if (inner.type == QXmlStreamReader::StartElement) {
+                    depth++;
+                } else if (inner.type == QXmlStreamReader::EndElement) {
+                    if (--depth == 0) break;
+                } else if (inner.type == QXmlStreamReader::Characters) {
+                    krefText.append(inner.text);
+                }
+            }
+        }
+        writeXdxfEvent(writer,event,krefText);
     }
+}
 
-    nodes = dd.elementsByTagName(ZDQSL("kref")); // Reference to another word
-    while (nodes.size()>0) {
-        QDomElement el = nodes.at(0).toElement();
-        el.setTagName(ZDQSL("a"));
-        el.setAttribute(ZDQSL("href"), ZDQSL( "zdict?word=" ) + QUrl::toPercentEncoding(el.text()));
+// Splits UTF-8 text at HTML special characters, only ASCII bytes are replaced,
+// so multibyte sequences are never split between runs
+template<typename Run, typename Replacement>
+void htmlPreformatRuns(const char *str, qsizetype size, const Run& run, const Replacement& replacement)
+{
+    qsizetype copied = 0;
+    for (qsizetype i = 0; i < size; i++) {
+        const char *markup = nullptr;
+        switch (str[i]) {
+            case '&': markup = "&amp;"; break;
+            case '<': markup = "&lt;"; break;
+            case '>': markup = "&gt;"; break;
+            case '"': markup = "&quot;"; break;
+            case '\t': markup = "&emsp;"; break;
+            case '\n': markup = "<br/>"; break;
+            case '\r': markup = ""; break;
+            default: continue;
+        }
+        if (i > copied)
+            run(str + copied,i - copied);
+        replacement(markup);
+        copied = i + 1;
     }
+    if (size > copied)
+        run(str + copied,size - copied);
+}
 
-    nodes = dd.elementsByTagName(ZDQSL("abr")); // Abbreviation
-    while (nodes.size()>0) {
-        QDomElement el = nodes.at(0).toElement();
-        el.setTagName(ZDQSL("span"));
-        QString style = articleStyles.value(ZDQSL("abbrev"));
-        if (!style.isEmpty())
-            el.setAttribute(ZDQSL("style"), style);
-    }
+}
 
-    nodes = dd.elementsByTagName(ZDQSL("dtrn")); // Direct translation
-    while (nodes.size()>0) {
-        QDomElement el = nodes.at(0).toElement();
-        el.setTagName(ZDQSL("span"));
-        QString style = articleStyles.value(ZDQSL("dtrn"));
-        if (!style.isEmpty())
-            el.setAttribute(ZDQSL("style"), style);
-    }
+QString ZDictConversions::htmlPreformat(const QString & str)
+{
+    QString result = str.toHtmlEscaped();
+    result.replace(u'\t',ZDQSL("&emsp;"));
+    result.replace(u'\n',ZDQSL("<br/>"));
+    result.remove(u'\r');
+
+    return result;
+}
+
+void ZDictConversions::htmlPreformatUtf8(const char *str, qsizetype size, QByteArray *out)
+{
+    out->reserve(out->size() + size + size / 8);
+    htmlPreformatRuns(str,size,[out](const char* run, qsizetype length){
+        out->append(run,length);
+    },[out](const char* replacement){
+        out->append(replacement);
+    });
+}
 
-    nodes = dd.elementsByTagName(ZDQSL("c")); // Color
-    while (nodes.size()>0) {
-        QDomElement el = nodes.at(0).toElement();
-        el.setTagName(ZDQSL("font"));
-        if ( el.hasAttribute(ZDQSL("c"))) {
-            el.setAttribute(ZDQSL("color"), el.attribute(ZDQSL("c")));
-            el.removeAttribute(ZDQSL("c"));
+void ZDictConversions::htmlPreformatUtf8(const char *str, qsizetype size, QString *out)
+{
+    out->reserve(out->size() + size + size / 8);
+    htmlPreformatRuns(str,size,[out](const char* run, qsizetype length){
+        out->append(QUtf8StringView(run,length));
+    },[out](const char* replacement){
+        out->append(QLatin1StringView(replacement));
+    });
+}
+
+QString ZDictConversions::xdxf2Html(const QString& in)
+{
+    QString inConverted = in;
+    inConverted.replace(u'\n',ZDQSL("<br/>"));
+    const QString xml = ZDQSL("<div>%1</div>").arg(inConverted);
+
+    QString res;
+    res.reserve(xml.size() + xml.size() / 2);
+    QXmlStreamReader reader(xml);
+    reader.setNamespaceProcessing(false); // keep prefixes and xmlns attributes as is
+    QXmlStreamWriter writer(&res);
+
+    // kref needs its whole text for href, so its subtree is buffered until the end tag
+    QVector<XdxfEvent> krefEvents;
+    int krefDepth = 0;
+
+    while (!reader.atEnd()) {
+        const auto token = reader.readNext();
+        if (reader.hasError()) break;
+
+        XdxfEvent event;
+        event.type = token;
+        switch (token) {
+            case QXmlStreamReader::StartElement:
+                event.name = reader.qualifiedName().toString();
+                event.attributes = reader.attributes();
+                break;
+            case QXmlStreamReader::Characters:
+                // whitespace between elements separates words, like "<abr>n.</abr> <dtrn>",
+                // it is collapsed to one space
+                event.text = reader.isWhitespace() ? ZDQSL(" ") : reader.text().toString();
+                break;
+            case QXmlStreamReader::Comment:
+                event.text = reader.text().toString();
+                break;
+            case QXmlStreamReader::ProcessingInstruction:
+                event.name = reader.processingInstructionTarget().toString();
+                event.text = reader.processingInstructionData().toString();
+                break;
+            case QXmlStreamReader::EndElement:
+                break;
+            default:
+                continue;
         }
-    }
 
-    nodes = dd.elementsByTagName(ZDQSL("co")); // Editorial comment
-    while (nodes.size()>0) {
-        QDomElement el = nodes.at(0).toElement();
-        el.setTagName(ZDQSL("span"));
-        QString style = articleStyles.value(ZDQSL("editorial"));
-        if (!style.isEmpty())
-            el.setAttribute(ZDQSL("style"), style);
-    }
+        const bool krefStart = (token == QXmlStreamReader::StartElement) && (event.name == QLatin1String("kref"));
+        if ((krefDepth == 0) && !krefStart) {
+            writeXdxfEvent(&writer,event,QString());
+            continue;
+        }
 
-    nodes = dd.elementsByTagName(ZDQSL("tr")); // Transcription
-    while (nodes.size()>0) {
-        QDomElement el = nodes.at(0).toElement();
-        el.setTagName(ZDQSL("span"));
-        QString style = articleStyles.value(ZDQSL("tr"));
-        if (!style.isEmpty())
-            el.setAttribute(ZDQSL("style"), style);
+        if (token == QXmlStreamReader::StartElement) {
+            krefDepth++;
+        } else if (token == QXmlStreamReader::EndElement) {
+            krefDepth--;
+        }
+        krefEvents.append(event);
+        if (krefDepth == 0) {
+            writeXdxfEvents(&writer,krefEvents);
+            krefEvents.clear();
+        }
     }
 
-    nodes = dd.elementsByTagName(ZDQSL("rref")); // Resource reference
-    while (nodes.size()>0) {
-        QDomElement el = nodes.at(0).toElement();
-        el.setTagName(ZDQSL("span"));
-        el.setAttribute(ZDQSL("style"), ZDQSL("display:none;"));
+    if (reader.hasError()) {
+        qWarning() << "Xdxf2html error, xml parse failed: " << reader.errorString() << " at "
+                   << reader.lineNumber() << reader.columnNumber();
+        qWarning() << "The input was: " << inConverted;
+        return in;
     }
 
-    QString res = dd.toString();
     return res;
 }
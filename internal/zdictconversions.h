@@ -2,6 +2,7 @@
 #define ZDICTCONVERSIONS_H
 
 #include <QString>
+#include <QByteArray>
 
 class ZDictConversions
 {
@@ -9,6 +10,9 @@ public:
     ZDictConversions() = default;;
 
     static QString htmlPreformat(const QString &str);
+    // same as htmlPreformat on UTF-8 bytes, appended to out without intermediate strings
+    static void htmlPreformatUtf8(const char* str, qsizetype size, QByteArray* out);
+    static void htmlPreformatUtf8(const char* str, qsizetype size, QString* out);
     static QString xdxf2Html(const QString &in);
 };
 
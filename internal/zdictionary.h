@@ -1,24 +1,77 @@
 #ifndef ZDICTIONARY_H
 #define ZDICTIONARY_H
 
+#include <functional>
 #include <QStringList>
+#include <QByteArrayList>
 #include <QRegularExpression>
 #include <QAtomicInteger>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QDeadlineTimer>
+#include <QSharedPointer>
+#include <QByteArrayView>
+#include <QVector>
+#include "zdictmetrics.h"
 
 namespace ZDict {
 
 const int defaultMaxLookupWords = 10000;
+const int defaultLookupPageSize = 100;
+const int defaultFuzzyDistance = 2;
+const int defaultFuzzyTimeBudgetMS = 150;
 
 #define ZDQSL QStringLiteral // NOLINT
 
 class ZDictController;
+class ZDictionary;
+
+class ZDictArticleSegment
+{
+public:
+    QChar type; // StarDict field type: 'm', 'h', 'x', ... for text, uppercase for blobs
+    qsizetype offset { 0 };
+    qsizetype size { 0 };
+
+    ZDictArticleSegment() = default;
+    ZDictArticleSegment(QChar aType, qsizetype aOffset, qsizetype aSize)
+        : type(aType), offset(aOffset), size(aSize) {}
+};
+
+/* Parsed article without HTML conversion.
+ * data may reference the mapped dictionary file, dictionary keeps it valid. */
+class ZDictRawArticle
+{
+public:
+    QSharedPointer<ZDictionary> dictionary; // set by controller
+    QString dictionaryName;
+    QByteArray data;
+    QVector<ZDictArticleSegment> segments;
+
+    ZDictRawArticle() = default;
+    QByteArrayView segmentData(int index) const {
+        const auto &segment = segments.at(index);
+        return QByteArrayView(data.constData() + segment.offset,segment.size);
+    }
+};
 
 class ZDictionary
 {
     friend class ZDictController;
+    friend class ZDictionaryUsage;
 
 private:
     QAtomicInteger<bool> m_stopRequest;
+    QAtomicInteger<bool> m_ready;
+    QMutex m_activationMutex;
+    bool m_activationFailed { false };
+
+    // Queries hold the read lock, so indexes are released only when the dictionary is idle.
+    // Writers never wait for the lock, nested read locks are safe.
+    QReadWriteLock m_indexLock;
+    QAtomicInteger<qint64> m_lastUse; // ms, monotonic clock
+    QAtomicInteger<int> m_indexLoads;
+    QAtomicInteger<int> m_evictions;
 
 public:
     ZDictionary() = default;
@@ -28,19 +81,101 @@ public:
 
     inline void resetStopRequest() { m_stopRequest.storeRelease(false); }
     inline void stopRequest() { m_stopRequest.storeRelease(true); }
+    inline bool isReady() const { return m_ready.loadAcquire(); }
+    inline qint64 lastUse() const { return m_lastUse.loadRelaxed(); }
+    inline int indexLoads() const { return m_indexLoads.loadRelaxed(); }
+    inline int evictions() const { return m_evictions.loadRelaxed(); }
 
 protected:
-    virtual bool loadIndexes(const QString& indexFile) = 0;
+    virtual bool loadInfo(const QString& infoFile) = 0; // metadata only, name and word count are available after it
+    virtual bool loadIndexes() = 0;
     virtual QStringList wordLookup(const QString& word,
                                    bool suppressMultiforms = false,
-                                   int maxLookupWords = defaultMaxLookupWords) = 0;
+                                   int maxLookupWords = defaultMaxLookupWords,
+                                   const QString& startAfter = QString()) = 0;
+    // (word, distance) pairs, best matches first, stops on deadline, stop request or cancellation
+    virtual QVector<QPair<QString,int> > fuzzyLookup(const QString& word,
+                                                     int maxDistance,
+                                                     int maxLookupWords,
+                                                     const QDeadlineTimer& deadline,
+                                                     const std::function<bool()>& isCancelled = nullptr) = 0;
+    // keys containing the word, in key order
+    virtual QStringList substringLookup(const QString& word, int maxLookupWords,
+                                        const std::function<bool()>& isCancelled = nullptr) = 0;
+    virtual bool buildSubstringIndex() = 0; // optional, substringLookup uses full scan without it
     virtual QString loadArticle(const QString& word) = 0;
+    virtual QStringList loadArticles(const QStringList& words) = 0; // result is aligned with words
+    // UTF-8 HTML, HTML fields are passed without UTF-16 conversion
+    virtual QByteArray loadArticleUtf8(const QString& word) = 0;
+    virtual QByteArrayList loadArticlesUtf8(const QStringList& words) = 0;
+    virtual QVector<ZDictRawArticle> loadRawArticles(const QString& word) = 0; // homonyms in index order
+    virtual QString renderRawArticle(const ZDictRawArticle& article) = 0;
+    virtual QByteArray renderRawArticleUtf8(const ZDictRawArticle& article) = 0;
     virtual QString getName() = 0;
     virtual QString getDescription() = 0;
     virtual int getWordCount() = 0;
+    virtual QString getInfoFile() = 0;
+    virtual bool isModified() = 0; // dictionary files changed on disk since loadInfo
+    virtual QStringList getFiles() = 0; // dictionary files on disk, watched for in-place changes
+    virtual void removeIndexCache() = 0; // drops compiled index cache file of replaced or removed dictionary
+    virtual ZDictDictionaryMetrics getMetrics() = 0; // name, index size and load time, resources
+    virtual qint64 memoryUsage() = 0; // loaded indexes footprint, for memory budget
+    virtual void releaseIndexes() = 0; // drop indexes only, articles data and mappings stay valid
 
     inline bool isStopRequested() { return m_stopRequest.loadAcquire(); }
 
+    // Loads indexes once, thread-safe. Lookups and articles are allowed only for ready dictionary.
+    bool activate() {
+        if (isReady()) return true;
+        QMutexLocker locker(&m_activationMutex);
+        if (isReady()) return true;
+        if (m_activationFailed) return false;
+        if (!loadIndexes()) {
+            m_activationFailed = true;
+            return false;
+        }
+        m_indexLoads.fetchAndAddRelaxed(1);
+        m_lastUse.storeRelaxed(QDeadlineTimer::current().deadline());
+        m_ready.storeRelease(true);
+        return true;
+    }
+
+    // Releases indexes of idle dictionary, next activate loads them again.
+    // Returns false if dictionary is not loaded or a query is running.
+    bool evict() {
+        if (!m_indexLock.tryLockForWrite()) return false;
+        bool res = false;
+        {
+            QMutexLocker locker(&m_activationMutex);
+            if (isReady()) {
+                m_ready.storeRelease(false);
+                releaseIndexes();
+                m_evictions.fetchAndAddRelaxed(1);
+                res = true;
+            }
+        }
+        m_indexLock.unlock();
+        return res;
+    }
+
+};
+
+// Pins dictionary indexes for the scope of a query, eviction skips pinned dictionaries
+class ZDictionaryUsage
+{
+private:
+    ZDictionary* m_dict;
+
+public:
+    explicit ZDictionaryUsage(ZDictionary* dict, bool updateLastUse = true)
+        : m_dict(dict) {
+        m_dict->m_indexLock.lockForRead();
+        if (updateLastUse)
+            m_dict->m_lastUse.storeRelaxed(QDeadlineTimer::current().deadline());
+    }
+    ~ZDictionaryUsage() { m_dict->m_indexLock.unlock(); }
+    ZDictionaryUsage(const ZDictionaryUsage& other) = delete;
+    ZDictionaryUsage& operator = (const ZDictionaryUsage &t) = delete;
 };
 
 }
@@ -0,0 +1,110 @@
+#ifndef ZDICTLRUCACHE_H
+#define ZDICTLRUCACHE_H
+
+#include <array>
+#include <QCache>
+#include <QMutex>
+#include <QAtomicInteger>
+
+namespace ZDict {
+
+class ZDictCacheStatistics
+{
+public:
+    quint64 hits { 0U };
+    quint64 misses { 0U };
+    qint64 totalCost { 0L };
+    qint64 maxCost { 0L };
+
+    ZDictCacheStatistics() = default;
+};
+
+/* Thread-safe cost-limited LRU cache.
+ * Keys are spread over independently locked QCache shards, so concurrent readers
+ * of different keys rarely contend. Values are returned by copy, use implicitly shared types. */
+template<typename Key, typename T>
+class ZDictLruCache
+{
+private:
+    static const int shardCount = 16;
+
+    class Shard
+    {
+    public:
+        QMutex mutex;
+        QCache<Key,T> cache;
+    };
+
+    std::array<Shard,shardCount> m_shards;
+    QAtomicInteger<quint64> m_hits;
+    QAtomicInteger<quint64> m_misses;
+
+    Shard& shard(const Key& key) { return m_shards[qHash(key) % shardCount]; }
+
+public:
+    explicit ZDictLruCache(qint64 maxCost) { setMaxCost(maxCost); }
+    ZDictLruCache(const ZDictLruCache& other) = delete;
+    ZDictLruCache& operator = (const ZDictLruCache &t) = delete;
+
+    void setMaxCost(qint64 maxCost) {
+        for (auto &s : m_shards) {
+            QMutexLocker locker(&s.mutex);
+            s.cache.setMaxCost(maxCost / shardCount);
+        }
+    }
+
+    bool find(const Key& key, T* value) {
+        Shard &s = shard(key);
+        QMutexLocker locker(&s.mutex);
+        const T* obj = s.cache.object(key);
+        if (obj == nullptr) {
+            m_misses.fetchAndAddRelaxed(1U);
+            return false;
+        }
+        *value = *obj;
+        m_hits.fetchAndAddRelaxed(1U);
+        return true;
+    }
+
+    void insert(const Key& key, const T& value, qint64 cost) {
+        Shard &s = shard(key);
+        QMutexLocker locker(&s.mutex);
+        s.cache.insert(key,new T(value),cost);
+    }
+
+    template<typename Predicate>
+    void removeIf(Predicate predicate) {
+        for (auto &s : m_shards) {
+            QMutexLocker locker(&s.mutex);
+            const auto keys = s.cache.keys();
+            for (const auto &key : keys) {
+                if (predicate(key))
+                    s.cache.remove(key);
+            }
+        }
+    }
+
+    void clear() {
+        for (auto &s : m_shards) {
+            QMutexLocker locker(&s.mutex);
+            s.cache.clear();
+        }
+    }
+
+    ZDictCacheStatistics statistics() {
+        ZDictCacheStatistics res;
+        res.hits = m_hits.loadRelaxed();
+        res.misses = m_misses.loadRelaxed();
+        for (auto &s : m_shards) {
+            QMutexLocker locker(&s.mutex);
+            res.totalCost += s.cache.totalCost();
+            res.maxCost += s.cache.maxCost();
+        }
+        return res;
+    }
+
+};
+
+}
+
+#endif // ZDICTLRUCACHE_H
@@ -0,0 +1,106 @@
+#include <QtAlgorithms>
+#include "zdictmetrics.h"
+
+namespace ZDict {
+
+int ZDictLatencyHistogram::bucket(qint64 ns)
+{
+    const int subBuckets = 1 << subBucketBits;
+    if (ns < subBuckets)
+        return static_cast<int>(qMax<qint64>(0,ns));
+
+    // exponent selects the power of two, next bits select the linear sub-bucket
+    const auto value = static_cast<quint64>(ns);
+    const int exponent = 63 - static_cast<int>(qCountLeadingZeroBits(value));
+    const int mantissa = static_cast<int>(value >> (exponent - subBucketBits)) & (subBuckets - 1);
+    return ((exponent - subBucketBits + 1) << subBucketBits) + mantissa;
+}
+
+qint64 ZDictLatencyHistogram::bucketUpperBound(int bucket)
+{
+    const int subBuckets = 1 << subBucketBits;
+    if (bucket < subBuckets)
+        return bucket;
+
+    const int exponent = (bucket >> subBucketBits) + subBucketBits - 1;
+    const int mantissa = bucket & (subBuckets - 1);
+    return (static_cast<qint64>(subBuckets + mantissa + 1) << (exponent - subBucketBits)) - 1;
+}
+
+void ZDictLatencyHistogram::record(qint64 ns)
+{
+    m_buckets[bucket(ns)].fetchAndAddRelaxed(1U);
+    m_total.fetchAndAddRelaxed(ns);
+
+    qint64 max = m_max.loadRelaxed();
+    while ((ns > max) && !m_max.testAndSetRelaxed(max,ns,max)) { }
+}
+
+void ZDictLatencyHistogram::reset()
+{
+    for (auto &b : m_buckets)
+        b.storeRelaxed(0U);
+    m_total.storeRelaxed(0L);
+    m_max.storeRelaxed(0L);
+}
+
+ZDictLatencyStatistics ZDictLatencyHistogram::statistics() const
+{
+    ZDictLatencyStatistics res;
+
+    // buckets are read without a lock, concurrent records may make the snapshot slightly inconsistent
+    std::array<quint64,bucketCount> buckets {};
+    for (int i = 0; i < bucketCount; i++) {
+        buckets[i] = m_buckets[i].loadRelaxed();
+        res.count += buckets[i];
+    }
+    res.total = m_total.loadRelaxed();
+    res.max = m_max.loadRelaxed();
+    if (res.count == 0U)
+        return res;
+
+    const auto percentile = [&buckets,&res](quint64 percent) -> qint64 {
+        const quint64 rank = qMax<quint64>(1U,(res.count * percent + 99U) / 100U);
+        quint64 seen = 0U;
+        for (int i = 0; i < bucketCount; i++) {
+            seen += buckets[i];
+            if (seen >= rank)
+                return qMin(bucketUpperBound(i),res.max);
+        }
+        return res.max;
+    };
+    res.p50 = percentile(50U);
+    res.p99 = percentile(99U);
+    return res;
+}
+
+void ZDictMetrics::reset()
+{
+    for (auto &histogram : m_latency)
+        histogram.reset();
+    m_dictZipBytesInflated.storeRelaxed(0U);
+    m_dictZipChunksInflated.storeRelaxed(0U);
+    m_supersededRequests.storeRelaxed(0U);
+    m_cancelRequests.storeRelaxed(0U);
+}
+
+void ZDictMetrics::fillSnapshot(ZDictMetricsSnapshot *snapshot) const
+{
+    snapshot->enabled = isEnabled();
+    snapshot->wordLookup = m_latency[static_cast<int>(Latency::WordLookup)].statistics();
+    snapshot->fuzzyLookup = m_latency[static_cast<int>(Latency::FuzzyLookup)].statistics();
+    snapshot->substringLookup = m_latency[static_cast<int>(Latency::SubstringLookup)].statistics();
+    snapshot->article = m_latency[static_cast<int>(Latency::Article)].statistics();
+    snapshot->dictZipBytesInflated = m_dictZipBytesInflated.loadRelaxed();
+    snapshot->dictZipChunksInflated = m_dictZipChunksInflated.loadRelaxed();
+    snapshot->supersededRequests = m_supersededRequests.loadRelaxed();
+    snapshot->cancelRequests = m_cancelRequests.loadRelaxed();
+}
+
+ZDictMetrics &metrics()
+{
+    static ZDictMetrics instance;
+    return instance;
+}
+
+}
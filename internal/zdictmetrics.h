@@ -0,0 +1,171 @@
+#ifndef ZDICTMETRICS_H
+#define ZDICTMETRICS_H
+
+#include <array>
+#include <QString>
+#include <QVector>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include "zdictlrucache.h"
+
+namespace ZDict {
+
+class ZDictLatencyStatistics
+{
+public:
+    quint64 count { 0U };
+    qint64 p50 { 0L };   // nanoseconds, upper bound of histogram bucket
+    qint64 p99 { 0L };
+    qint64 max { 0L };
+    qint64 total { 0L };
+
+    ZDictLatencyStatistics() = default;
+};
+
+/* Lock-free log-linear histogram, four buckets per power of two,
+ * so percentiles are within 25% of the exact value. */
+class ZDictLatencyHistogram
+{
+private:
+    static const int subBucketBits = 2;
+    static const int bucketCount = 64 << subBucketBits;
+
+    std::array<QAtomicInteger<quint64>,bucketCount> m_buckets {};
+    QAtomicInteger<qint64> m_total;
+    QAtomicInteger<qint64> m_max;
+
+    static int bucket(qint64 ns);
+    static qint64 bucketUpperBound(int bucket);
+
+public:
+    ZDictLatencyHistogram() = default;
+    ZDictLatencyHistogram(const ZDictLatencyHistogram& other) = delete;
+    ZDictLatencyHistogram& operator = (const ZDictLatencyHistogram &t) = delete;
+
+    void record(qint64 ns);
+    void reset();
+    ZDictLatencyStatistics statistics() const;
+
+};
+
+class ZDictDictionaryMetrics
+{
+public:
+    QString name;
+    QString infoFile;
+    bool ready { false };
+    qint64 indexLoadTimeMS { -1L }; // last index load, IDX parsing or compiled cache mapping
+    bool indexFromCache { false };
+    int indexLoads { 0 };           // first load and reloads after eviction
+    int evictions { 0 };            // releases by memory budget
+    qint64 indexBytes { 0L };
+    qint64 substringIndexBytes { 0L };
+    int tokenCount { 0 };           // headwords and synonyms
+    int entryCount { 0 };           // IDX records
+    int openFiles { 0 };            // file handles held by dictionary
+    int mappedFiles { 0 };          // memory-mapped index cache and DICT files
+
+    ZDictDictionaryMetrics() = default;
+};
+
+class ZDictMemoryStatistics
+{
+public:
+    qint64 budget { 0L };           // 0 - unlimited
+    qint64 used { 0L };             // loaded indexes of all dictionaries
+    int loadedDictionaries { 0 };
+    int dictionaries { 0 };
+    quint64 evictions { 0U };
+    quint64 reloads { 0U };         // index loads after eviction
+
+    ZDictMemoryStatistics() = default;
+};
+
+class ZDictMetricsSnapshot
+{
+public:
+    bool enabled { false }; // latencies and counters are collected only when enabled
+    QVector<ZDictDictionaryMetrics> dictionaries;
+    ZDictLatencyStatistics wordLookup;
+    ZDictLatencyStatistics fuzzyLookup;
+    ZDictLatencyStatistics substringLookup;
+    ZDictLatencyStatistics article;
+    quint64 dictZipBytesInflated { 0U };
+    quint64 dictZipChunksInflated { 0U };
+    quint64 supersededRequests { 0U }; // async requests replaced by newer ones before completion
+    quint64 cancelRequests { 0U };     // cancelActiveWork calls
+    ZDictCacheStatistics chunkCache;
+    ZDictCacheStatistics articleCache;
+    ZDictMemoryStatistics memory;
+
+    ZDictMetricsSnapshot() = default;
+};
+
+/* Process-wide runtime counters. Disabled by default, then instrumented
+ * code paths do only one relaxed atomic load. */
+class ZDictMetrics
+{
+public:
+    enum class Latency {
+        WordLookup = 0,
+        FuzzyLookup,
+        SubstringLookup,
+        Article,
+        LatencyCount
+    };
+
+private:
+    QAtomicInteger<bool> m_enabled;
+    std::array<ZDictLatencyHistogram,static_cast<int>(Latency::LatencyCount)> m_latency;
+    QAtomicInteger<quint64> m_dictZipBytesInflated;
+    QAtomicInteger<quint64> m_dictZipChunksInflated;
+    QAtomicInteger<quint64> m_supersededRequests;
+    QAtomicInteger<quint64> m_cancelRequests;
+
+public:
+    ZDictMetrics() = default;
+    ZDictMetrics(const ZDictMetrics& other) = delete;
+    ZDictMetrics& operator = (const ZDictMetrics &t) = delete;
+
+    inline bool isEnabled() const { return m_enabled.loadRelaxed(); }
+    void setEnabled(bool enabled) { m_enabled.storeRelaxed(enabled); }
+    void reset();
+
+    void recordLatency(Latency kind, qint64 ns) { m_latency[static_cast<int>(kind)].record(ns); }
+    void addDictZipInflated(qint64 bytes) {
+        m_dictZipBytesInflated.fetchAndAddRelaxed(static_cast<quint64>(bytes));
+        m_dictZipChunksInflated.fetchAndAddRelaxed(1U);
+    }
+    void addSupersededRequest() { m_supersededRequests.fetchAndAddRelaxed(1U); }
+    void addCancelRequest() { m_cancelRequests.fetchAndAddRelaxed(1U); }
+
+    void fillSnapshot(ZDictMetricsSnapshot* snapshot) const; // global part, without dictionaries
+
+};
+
+ZDictMetrics& metrics();
+
+// Records scope duration to latency histogram, does nothing when metrics are disabled
+class ZDictLatencyTimer
+{
+private:
+    QElapsedTimer m_timer;
+    ZDictMetrics::Latency m_kind;
+
+public:
+    explicit ZDictLatencyTimer(ZDictMetrics::Latency kind)
+        : m_kind(kind) {
+        if (metrics().isEnabled())
+            m_timer.start();
+    }
+    ~ZDictLatencyTimer() {
+        if (m_timer.isValid())
+            metrics().recordLatency(m_kind,m_timer.nsecsElapsed());
+    }
+    ZDictLatencyTimer(const ZDictLatencyTimer& other) = delete;
+    ZDictLatencyTimer& operator = (const ZDictLatencyTimer &t) = delete;
+};
+
+}
+
+#endif // ZDICTMETRICS_H
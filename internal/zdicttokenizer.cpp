@@ -0,0 +1,146 @@
+#include <array>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <QString>
+#include <QChar>
+#include "zdicttokenizer.h"
+
+namespace {
+
+// PCRE2 with UCP: \s is Z category plus \h and \v, [:punct:] is P category plus S category below 256.
+// For ASCII it is \t\n\v\f\r, space and all printable non-alphanumerics.
+const std::array<bool,128> asciiSeparators = []{
+    std::array<bool,128> res {};
+    for (int c = 0; c < 128; c++) {
+        res[c] = ((c >= 0x09 && c <= 0x0D) || c == 0x20 ||
+                  (c > 0x20 && c < 0x7F && !((c >= '0' && c <= '9') ||
+                                             (c >= 'A' && c <= 'Z') ||
+                                             (c >= 'a' && c <= 'z'))));
+    }
+    return res;
+}();
+
+}
+
+namespace ZDict {
+
+bool ZDictTokenizer::isSeparator(char32_t ucs4)
+{
+    if (ucs4 < 128U)
+        return asciiSeparators[ucs4];
+
+    // \h and \v members outside of Z category
+    if (ucs4 == 0x0085U || ucs4 == 0x180EU)
+        return true;
+
+    switch (QChar::category(ucs4)) {
+        case QChar::Separator_Space:
+        case QChar::Separator_Line:
+        case QChar::Separator_Paragraph:
+        case QChar::Punctuation_Connector:
+        case QChar::Punctuation_Dash:
+        case QChar::Punctuation_Open:
+        case QChar::Punctuation_Close:
+        case QChar::Punctuation_InitialQuote:
+        case QChar::Punctuation_FinalQuote:
+        case QChar::Punctuation_Other:
+            return true;
+        case QChar::Symbol_Math:
+        case QChar::Symbol_Currency:
+        case QChar::Symbol_Modifier:
+        case QChar::Symbol_Other:
+            return (ucs4 < 256U);
+        default:
+            return false;
+    }
+}
+
+int ZDictTokenizer::tokenize(const char *word, int length)
+{
+    m_tokens.clear();
+    if (length <= 0) return 0;
+
+    const int res = tokenizeAscii(word,length);
+    if (res >= 0) return res;
+
+    m_tokens.clear();
+    return tokenizeUnicode(word,length);
+}
+
+int ZDictTokenizer::tokenizeAscii(const char *word, int length)
+{
+    if (m_folded.size() < length)
+        m_folded.resize(length);
+    char* out = m_folded.data();
+
+    // fold case, bail out on first non-ASCII byte
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i beforeA = _mm_set1_epi8('A' - 1);
+    const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(word + i));
+        if (_mm_movemask_epi8(v) != 0) return -1;
+        const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v,beforeA),_mm_cmplt_epi8(v,afterZ));
+        v = _mm_add_epi8(v,_mm_and_si128(upper,caseBit));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),v);
+    }
+#endif
+    for (; i < length; i++) {
+        const auto c = static_cast<uchar>(word[i]);
+        if (c >= 0x80U) return -1;
+        out[i] = static_cast<char>((c >= 'A' && c <= 'Z') ? (c | 0x20U) : c);
+    }
+
+    int start = 0;
+    for (i = 0; i < length; i++) {
+        if (asciiSeparators[static_cast<uchar>(out[i])]) {
+            if (i > start)
+                m_tokens.append(qMakePair(start,i - start));
+            start = i + 1;
+        }
+    }
+    if (length > start)
+        m_tokens.append(qMakePair(start,length - start));
+
+    return static_cast<int>(m_tokens.count());
+}
+
+int ZDictTokenizer::tokenizeUnicode(const char *word, int length)
+{
+    // invalid sequences are replaced the same way as with QString split
+    const QString str = QString::fromUtf8(word,length);
+    m_folded.clear();
+
+    const auto appendToken = [this,&str](qsizetype start, qsizetype end){
+        if (end <= start) return;
+        const QByteArray token = str.mid(start,end - start).toLower().toUtf8();
+        m_tokens.append(qMakePair(static_cast<int>(m_folded.size()),static_cast<int>(token.size())));
+        m_folded.append(token);
+    };
+
+    qsizetype start = 0;
+    qsizetype i = 0;
+    while (i < str.size()) {
+        char32_t ucs4 = str.at(i).unicode();
+        qsizetype len = 1;
+        if (QChar::isHighSurrogate(ucs4) && (i + 1 < str.size()) && str.at(i + 1).isLowSurrogate()) {
+            ucs4 = QChar::surrogateToUcs4(str.at(i),str.at(i + 1));
+            len = 2;
+        }
+        if (isSeparator(ucs4)) {
+            appendToken(start,i);
+            start = i + len;
+        }
+        i += len;
+    }
+    appendToken(start,str.size());
+
+    return static_cast<int>(m_tokens.count());
+}
+
+}
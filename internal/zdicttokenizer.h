@@ -0,0 +1,37 @@
+#ifndef ZDICTTOKENIZER_H
+#define ZDICTTOKENIZER_H
+
+#include <QByteArray>
+#include <QVector>
+#include <QPair>
+
+namespace ZDict {
+
+/* Headword tokenizer for index building.
+ * Splits UTF-8 headword by whitespaces and punctuation, same as QRegularExpression
+ * "[\s[:punct:]]" with Unicode properties, and lowercases tokens in the same pass.
+ * Pure ASCII headwords are handled directly on UTF-8 bytes (SSE2 when available),
+ * others go through QString. Buffers are reused between calls, not thread-safe. */
+class ZDictTokenizer
+{
+private:
+    QByteArray m_folded;
+    QVector<QPair<int,int> > m_tokens; // (start, length) in m_folded
+
+    int tokenizeAscii(const char* word, int length);
+    int tokenizeUnicode(const char* word, int length);
+
+public:
+    ZDictTokenizer() = default;
+
+    // Returns token count, tokens are valid until next call
+    int tokenize(const char* word, int length);
+    const char* tokenData(int index) const { return m_folded.constData() + m_tokens.at(index).first; }
+    int tokenLength(int index) const { return m_tokens.at(index).second; }
+
+    static bool isSeparator(char32_t ucs4);
+};
+
+}
+
+#endif // ZDICTTOKENIZER_H
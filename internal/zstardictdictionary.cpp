@@ -4,39 +4,120 @@
  *   (c) 2008-2011 Konstantin Isakov <ikm@users.berlios.de>
  */
 
+#include <algorithm>
+#include <execution>
+#include <cstring>
+#include <functional>
 #include <utility>
 
 #include <QDir>
+#include <QSet>
 #include <QFile>
 #include <QFileInfo>
+#include <QDateTime>
+#include <QCryptographicHash>
 #include <QTextStream>
 #include <QCoreApplication>
+#include <QThread>
+#include <QElapsedTimer>
 #include "zstardictdictionary.h"
 #include "zdictcompress.h"
 #include "zdictconversions.h"
+#include "zdicttokenizer.h"
 
 #include <QDebug>
 
+namespace {
+
+/* Splits StarDict records buffer (word, NUL, fixed size tail) at record boundaries,
+ * one segment per worker, but not too small */
+QVector<QPair<const char*,const char*> > splitRecords(const QByteArray& data, qsizetype recordTailSize)
+{
+    const qsizetype minSegmentSize = 1024 * 1024;
+
+    const char* dataBegin = data.constData();
+    const char* dataEnd = dataBegin + data.size();
+    const qsizetype segmentCount = qBound<qsizetype>(1,data.size() / minSegmentSize,
+                                                     QThread::idealThreadCount());
+    const qsizetype segmentSize = data.size() / segmentCount;
+
+    QVector<QPair<const char*,const char*> > segments;
+    const char* segmentBegin = dataBegin;
+    for (const char* it = dataBegin; it < dataEnd;) {
+        if (it - segmentBegin >= segmentSize) {
+            segments.append(qMakePair(segmentBegin,it));
+            segmentBegin = it;
+        }
+        const auto *wordEnd = static_cast<const char*>(memchr(it,0,dataEnd - it));
+        if (wordEnd == nullptr) break;
+        it = wordEnd + 1 + recordTailSize;
+    }
+    segments.append(qMakePair(segmentBegin,dataEnd));
+
+    return segments;
+}
+
+}
+
 namespace ZDict {
 
+namespace {
+
+ZDictArticleCache& renderedArticleCache(QString* /*unused*/) { return articleCache(); }
+ZDictArticleUtf8Cache& renderedArticleCache(QByteArray* /*unused*/) { return articleUtf8Cache(); }
+
+qint64 renderedArticleCost(const QString& article) { return article.size() * static_cast<qint64>(sizeof(QChar)); }
+qint64 renderedArticleCost(const QByteArray& article) { return article.size(); }
+
+QString renderedWordSeparator(const QString& word, QString* /*unused*/)
+{
+    return ZDQSL("<br/><b>%1</b>").arg(word);
+}
+
+QByteArray renderedWordSeparator(const QString& word, QByteArray* /*unused*/)
+{
+    return ZDQSL("<br/><b>%1</b>").arg(word).toUtf8();
+}
+
+}
+
+ZDictArticleCache& articleCache()
+{
+    static ZDictArticleCache cache(defaultArticleCacheSize);
+    return cache;
+}
+
+ZDictArticleUtf8Cache& articleUtf8Cache()
+{
+    static ZDictArticleUtf8Cache cache(defaultArticleCacheSize);
+    return cache;
+}
+
 ZStardictDictionary::ZStardictDictionary() = default;
 
 ZStardictDictionary::~ZStardictDictionary()
 {
+    dropCachedArticles();
+    closeDict();
+}
+
+void ZStardictDictionary::closeDict()
+{
+    if (m_dictData.mapped != nullptr)
+        m_dict.unmap(const_cast<uchar*>(m_dictData.mapped));
     if (m_dict.isOpen())
         m_dict.close();
+    m_dictData.clear();
 }
 
-bool ZStardictDictionary::loadIndexes(const QString &indexFile)
+bool ZStardictDictionary::loadInfo(const QString &infoFile)
 {
-    m_index.clear();
-
-    QFile ifo(indexFile);
+    QFile ifo(infoFile);
     if (!ifo.open(QIODevice::ReadOnly)) return false;
 
     QTextStream ifos(&ifo);
 
-    int idxFileSize = 0;
+    unsigned int idxFileSize = 0;
 
     QString line;
     while (line.isEmpty() && !ifos.atEnd())
@@ -63,6 +144,11 @@ bool ZStardictDictionary::loadIndexes(const QString &indexFile)
             int wc = param.toInt(&ok);
             if (ok)
                 m_wordCount = wc;
+        } else if (name == ZDQSL("synwordcount")) {
+            bool ok = false;
+            int wc = param.toInt(&ok);
+            if (ok)
+                m_synWordCount = wc;
         } else if (name == ZDQSL("bookname")) {
             m_name = param;
         } else if (name == ZDQSL("description")) {
@@ -81,64 +167,211 @@ bool ZStardictDictionary::loadIndexes(const QString &indexFile)
         return false;
     }
 
-    if (!loadStardictIndex(indexFile,idxFileSize)) {
+    m_ifoFilename = infoFile;
+    m_idxFileSize = idxFileSize;
+    m_filesFingerprint = filesFingerprint(infoFile);
+
+    return true;
+}
+
+bool ZStardictDictionary::loadIndexes()
+{
+    m_substringIndexMutex.lock();
+    m_substringIndex.clear();
+    m_substringIndexMutex.unlock();
+    m_index.clear();
+
+    // after eviction DICT stays open and mapped, its cached articles are still valid.
+    // If dictionary files were changed on disk since loadInfo, new IDX offsets must not be
+    // applied to the old mapping, and it can't be remapped while raw articles still point into it:
+    // the dictionary stays inactive until the controller replaces it with a new object.
+    if (m_dict.isOpen() && isModified()) {
+        qWarning() << "Stardict: dictionary files changed on disk, waiting for reload" << m_ifoFilename;
+        return false;
+    }
+    const bool dictLoaded = m_dict.isOpen();
+    if (!dictLoaded) {
+        static QAtomicInteger<quint64> lastArticleCacheId;
+        dropCachedArticles();
+        m_articleCacheId = lastArticleCacheId.fetchAndAddRelaxed(1U) + 1U;
+    }
+
+    if (m_ifoFilename.isEmpty())
+        return false;
+
+    QElapsedTimer loadTimer;
+    loadTimer.start();
+    m_indexLoadTimeMS = -1L;
+    m_indexFromCache = false;
+
+    if (!loadStardictIndex(m_ifoFilename,m_idxFileSize)) {
         qWarning() << "Stardict: Unable to load IDX file.";
         return false;
     }
 
-    if (!loadStardictDict(indexFile)) {
+    if (!dictLoaded && !loadStardictDict(m_ifoFilename)) {
         qWarning() << "Stardict: Unable to load DICT file.";
         m_index.clear();
         return false;
     }
 
+    m_indexLoadTimeMS = loadTimer.elapsed();
     return true;
 }
 
-bool ZStardictDictionary::loadStardictIndex(const QString &ifoFilename, unsigned int expectedIndexFileSize)
+void ZStardictDictionary::releaseIndexes()
 {
-    static const QRegularExpression rxSplitter(ZDQSL("[\\s[:punct:]]"),
-                                               QRegularExpression::UseUnicodePropertiesOption);
+    m_substringIndexMutex.lock();
+    m_substringIndex.clear();
+    m_substringIndexMutex.unlock();
+    m_index.clear();
+}
 
+qint64 ZStardictDictionary::memoryUsage()
+{
+    qint64 res = m_index.memoryUsage();
+
+    m_substringIndexMutex.lock();
+    if (m_substringIndex)
+        res += m_substringIndex->memoryUsage();
+    m_substringIndexMutex.unlock();
+
+    return res;
+}
+
+QString ZStardictDictionary::idxFilename(const QString &ifoFilename) const
+{
     QFileInfo fi(ifoFilename);
-    const QString idxFilename = fi.dir().filePath(ZDQSL("%1.%2").arg(fi.completeBaseName(),ZDQSL("idx")));
-    const QString gzIdxFilename = fi.dir().filePath(ZDQSL("%1.%2").arg(fi.completeBaseName(),ZDQSL("idx.gz")));
-
-    bool gz = false;
-    QFile idx(idxFilename);
-    if (!idx.exists()) {
-        idx.setFileName(gzIdxFilename);
-        if (!idx.exists()) {
-            qWarning() << "Stardict: IDX file not found.";
-            return false;
-        }
-        gz = true;
-    }
-    if (!idx.open(QIODevice::ReadOnly)) {
-        qWarning() << "Stardict: IDX file unable to open.";
-        return false;
+    const QString plainFilename = fi.dir().filePath(ZDQSL("%1.%2").arg(fi.completeBaseName(),ZDQSL("idx")));
+    if (QFileInfo::exists(plainFilename))
+        return plainFilename;
+
+    const QString gzFilename = fi.dir().filePath(ZDQSL("%1.%2").arg(fi.completeBaseName(),ZDQSL("idx.gz")));
+    if (QFileInfo::exists(gzFilename))
+        return gzFilename;
+
+    return QString();
+}
+
+QStringList ZStardictDictionary::existingFiles(const QString &ifoFilename) const
+{
+    QFileInfo fi(ifoFilename);
+    const QStringList suffixes({ ZDQSL("ifo"), ZDQSL("idx"), ZDQSL("idx.gz"), ZDQSL("syn"),
+                                 ZDQSL("dict"), ZDQSL("dict.dz") });
+
+    QStringList res;
+    for (const auto &suffix : suffixes) {
+        const QString filename = fi.dir().filePath(ZDQSL("%1.%2").arg(fi.completeBaseName(),suffix));
+        if (QFileInfo::exists(filename))
+            res.append(filename);
     }
-    QByteArray binidx = idx.readAll();
-    idx.close();
-    if (gz)
-        binidx = gzInflate(binidx);
+    return res;
+}
 
-    if (static_cast<unsigned int>(binidx.size()) != expectedIndexFileSize) {
-        qWarning() << "Stardict: unexpected IDX file size.";
-        return false;
+QString ZStardictDictionary::filesFingerprint(const QString &ifoFilename) const
+{
+    QStringList res;
+    for (const auto &filename : existingFiles(ifoFilename)) {
+        const QFileInfo file(filename);
+        res.append(ZDQSL("%1:%2:%3").arg(file.fileName()).arg(file.size())
+                   .arg(file.lastModified().toMSecsSinceEpoch()));
     }
+    return res.join(u';');
+}
+
+QStringList ZStardictDictionary::getFiles()
+{
+    if (m_ifoFilename.isEmpty())
+        return QStringList();
+
+    return existingFiles(m_ifoFilename);
+}
+
+void ZStardictDictionary::removeIndexCache()
+{
+    // cache file may be still mapped by this dictionary, mapping stays valid after unlink
+    const QString cacheFilename = indexCacheFilename(m_ifoFilename);
+    if (!cacheFilename.isEmpty() && QFileInfo::exists(cacheFilename) && !QFile::remove(cacheFilename))
+        qWarning() << "Stardict: unable to remove index cache" << cacheFilename;
+}
+
+bool ZStardictDictionary::isModified()
+{
+    if (m_ifoFilename.isEmpty())
+        return true;
+
+    return (filesFingerprint(m_ifoFilename) != m_filesFingerprint);
+}
+
+ZDictDictionaryMetrics ZStardictDictionary::getMetrics()
+{
+    ZDictDictionaryMetrics res;
+    res.name = m_name;
+    res.infoFile = m_ifoFilename;
+    res.ready = isReady();
+    res.indexLoads = indexLoads();
+    res.evictions = evictions();
+    // index members are written by loadIndexes, read them only after activation
+    if (!res.ready)
+        return res;
+
+    res.indexLoadTimeMS = m_indexLoadTimeMS;
+    res.indexFromCache = m_indexFromCache;
+    res.indexBytes = m_index.memoryUsage();
+    res.tokenCount = m_index.count();
+    res.entryCount = m_index.entryCount();
+    res.openFiles = (m_dict.isOpen() ? 1 : 0);
+    res.mappedFiles = (m_index.isMapped() ? 1 : 0) + ((m_dictData.mapped != nullptr) ? 1 : 0);
+
+    m_substringIndexMutex.lock();
+    const auto substringIndex = m_substringIndex;
+    m_substringIndexMutex.unlock();
+    if (substringIndex)
+        res.substringIndexBytes = substringIndex->memoryUsage();
+
+    return res;
+}
+
+QString ZStardictDictionary::indexCacheFilename(const QString &ifoFilename) const
+{
+    if (m_indexCacheDirectory.isEmpty())
+        return QString();
+
+    const QByteArray hash = QCryptographicHash::hash(QFileInfo(ifoFilename).absoluteFilePath().toUtf8(),
+                                                     QCryptographicHash::Sha1).toHex();
+    return QDir(m_indexCacheDirectory).filePath(ZDQSL("%1.zdx").arg(QString::fromLatin1(hash)));
+}
+
+void ZStardictDictionary::setIndexCacheDirectory(const QString &path)
+{
+    m_indexCacheDirectory = path;
+}
+
+QString ZStardictDictionary::synFilename(const QString &ifoFilename) const
+{
+    QFileInfo fi(ifoFilename);
+    const QString filename = fi.dir().filePath(ZDQSL("%1.%2").arg(fi.completeBaseName(),ZDQSL("syn")));
+    if (QFileInfo::exists(filename))
+        return filename;
+
+    return QString();
+}
+
+int ZStardictDictionary::parseIndexSegment(const char *begin, const char *end, ZStardictIndexBuilder *tokens) const
+{
+    ZDictTokenizer tokenizer;
+    const qsizetype recordTailSize = (m_64bitOffset ? sizeof(quint64) : sizeof(quint32)) + sizeof(quint32);
 
-    binidx.append(u'\0');
     int wordCounter = 0;
-    for (auto it = binidx.constBegin(), end = binidx.constEnd(); it<(end-1);) {
-        if (QCoreApplication::closingDown()) return false;
+    for (const char* it = begin; it<end;) {
+        if (QCoreApplication::closingDown()) return wordCounter;
 
-        int wordLen = strlen(it);
-        if ((it+wordLen+1+sizeof(quint32)*2)>end) {
+        const int wordLen = static_cast<int>(qstrnlen(it,end - it));
+        if ((it+wordLen+1+recordTailSize)>end) {
             //qWarning() << "Stardict: unexpected end of IDX file.";
             break;
         }
-        QString word = QString::fromUtf8(it,wordLen);
+        const char* wordData = it;
         it += wordLen + 1;
         quint64 offset = 0U;
         if (m_64bitOffset) {
@@ -152,20 +385,166 @@ bool ZStardictDictionary::loadStardictIndex(const QString &ifoFilename, unsigned
         quint32 size = be32toh(*(reinterpret_cast<quint32*>(const_cast<char*>(it))));
         it += sizeof(quint32);
 
+        const quint32 entry = tokens->addEntry(offset,size);
+
         // split complex form by whitespaces/punctuation
-        const QStringList sl = word.split(rxSplitter,Qt::SkipEmptyParts);
-        for (const auto& s : sl)
-            m_index.insert(s.toLower(),qMakePair(offset,size));
+        const int tokenCount = tokenizer.tokenize(wordData,wordLen);
+        for (int i = 0; i < tokenCount; i++)
+            tokens->add(tokenizer.tokenData(i),tokenizer.tokenLength(i),entry);
+
+        if (tokenCount>1) // add complex form itself
+            tokens->add(wordData,wordLen,entry);
+
+        wordCounter++;
+    }
+
+    return wordCounter;
+}
 
-        if (sl.count()>1) // add complex form itself
-            m_index.insert(word,qMakePair(offset,size));
+int ZStardictDictionary::parseSynonymSegment(const char *begin, const char *end, quint32 entryCount,
+                                             ZStardictIndexBuilder *tokens) const
+{
+    ZDictTokenizer tokenizer;
+
+    int wordCounter = 0;
+    for (const char* it = begin; it<end;) {
+        if (QCoreApplication::closingDown()) return wordCounter;
 
+        const int wordLen = static_cast<int>(qstrnlen(it,end - it));
+        if ((it+wordLen+1+sizeof(quint32))>end) {
+            //qWarning() << "Stardict: unexpected end of SYN file.";
+            break;
+        }
+        const char* wordData = it;
+        it += wordLen + 1;
+        // synonym refers to IDX record number, that is the entry id
+        const quint32 entry = be32toh(*(reinterpret_cast<quint32*>(const_cast<char*>(it))));
+        it += sizeof(quint32);
         wordCounter++;
+
+        if (entry >= entryCount) continue;
+
+        const int tokenCount = tokenizer.tokenize(wordData,wordLen);
+        for (int i = 0; i < tokenCount; i++)
+            tokens->add(tokenizer.tokenData(i),tokenizer.tokenLength(i),entry);
+
+        if (tokenCount>1)
+            tokens->add(wordData,wordLen,entry);
+    }
+
+    return wordCounter;
+}
+
+bool ZStardictDictionary::loadStardictIndex(const QString &ifoFilename, unsigned int expectedIndexFileSize)
+{
+    QFile idx(idxFilename(ifoFilename));
+    if (idx.fileName().isEmpty()) {
+        qWarning() << "Stardict: IDX file not found.";
+        return false;
     }
+    const bool gz = idx.fileName().endsWith(ZDQSL(".gz"));
+
+    QFile syn(synFilename(ifoFilename));
+
+    const QFileInfo ifoInfo(ifoFilename);
+    const QFileInfo idxInfo(idx);
+    ZStardictIndexFingerprint fingerprint;
+    fingerprint.ifoSize = ifoInfo.size();
+    fingerprint.ifoModified = ifoInfo.lastModified().toMSecsSinceEpoch();
+    fingerprint.idxSize = idxInfo.size();
+    fingerprint.idxModified = idxInfo.lastModified().toMSecsSinceEpoch();
+    if (!syn.fileName().isEmpty()) {
+        const QFileInfo synInfo(syn);
+        fingerprint.synSize = synInfo.size();
+        fingerprint.synModified = synInfo.lastModified().toMSecsSinceEpoch();
+    }
+
+    // compiled index is up to date, map it instead of parsing IDX
+    const QString cacheFilename = indexCacheFilename(ifoFilename);
+    if (!cacheFilename.isEmpty() && m_index.load(cacheFilename,fingerprint)) {
+        m_indexFromCache = true;
+        return true;
+    }
+
+    if (!idx.open(QIODevice::ReadOnly)) {
+        qWarning() << "Stardict: IDX file unable to open.";
+        return false;
+    }
+    // compressed index is inflated in a streaming way into buffer presized by idxfilesize from IFO
+    QByteArray binidx = gz ? gzInflate(&idx,expectedIndexFileSize) : idx.readAll();
+    idx.close();
 
-    if (wordCounter!=m_wordCount)
+    if (static_cast<unsigned int>(binidx.size()) != expectedIndexFileSize) {
+        qWarning() << "Stardict: unexpected IDX file size.";
+        return false;
+    }
+
+    const qsizetype recordTailSize = (m_64bitOffset ? sizeof(quint64) : sizeof(quint32)) + sizeof(quint32);
+    const auto segments = splitRecords(binidx,recordTailSize);
+
+    QVector<ZStardictIndexBuilder> builders(segments.count());
+    QAtomicInteger<int> wordCounter;
+    std::for_each(std::execution::par,segments.constBegin(),segments.constEnd(),
+                  [this,&segments,&builders,&wordCounter,&binidx]
+                  (const QPair<const char*,const char*>& segment){
+        auto &tokens = builders[&segment - segments.constData()];
+        const double share = static_cast<double>(segment.second - segment.first) / binidx.size();
+        tokens.reserve(static_cast<int>(m_wordCount * 2 * share),
+                       static_cast<int>(segment.second - segment.first),
+                       static_cast<int>(m_wordCount * share));
+        wordCounter.fetchAndAddRelaxed(parseIndexSegment(segment.first,segment.second,&tokens));
+    });
+
+    if (QCoreApplication::closingDown()) return false;
+
+    if (wordCounter.loadRelaxed()!=m_wordCount)
         qWarning() << "Stardict: Unexpected dictionary word count.";
 
+    binidx.clear();
+
+    // entry ids are IDX record numbers
+    quint32 entryCount = 0U;
+    for (auto &builder : builders) {
+        builder.setEntryBase(entryCount);
+        entryCount += static_cast<quint32>(builder.entryCount());
+    }
+
+    // synonyms refer to IDX entries, collected as separate runs
+    if (!syn.fileName().isEmpty()) {
+        if (syn.open(QIODevice::ReadOnly)) {
+            const QByteArray binsyn = syn.readAll();
+            syn.close();
+
+            const auto synSegments = splitRecords(binsyn,sizeof(quint32));
+            QVector<ZStardictIndexBuilder> synBuilders(synSegments.count());
+            QAtomicInteger<int> synCounter;
+            std::for_each(std::execution::par,synSegments.constBegin(),synSegments.constEnd(),
+                          [this,&synSegments,&synBuilders,&synCounter,entryCount]
+                          (const QPair<const char*,const char*>& segment){
+                auto &tokens = synBuilders[&segment - synSegments.constData()];
+                tokens.reserve(0,static_cast<int>(segment.second - segment.first));
+                synCounter.fetchAndAddRelaxed(parseSynonymSegment(segment.first,segment.second,
+                                                                  entryCount,&tokens));
+            });
+
+            if (QCoreApplication::closingDown()) return false;
+
+            if (synCounter.loadRelaxed()!=m_synWordCount)
+                qWarning() << "Stardict: Unexpected dictionary synonym count.";
+
+            builders.append(synBuilders);
+        } else {
+            qWarning() << "Stardict: SYN file unable to open.";
+        }
+    }
+
+    m_index.build(builders,fingerprint);
+    if (!cacheFilename.isEmpty() && m_index.save(cacheFilename)) {
+        // switch to the mapped image, so the index is backed by page cache
+        if (!m_index.load(cacheFilename,fingerprint))
+            m_index.build(builders,fingerprint);
+    }
+
     return true;
 }
 
@@ -177,7 +556,14 @@ bool ZStardictDictionary::loadStardictDict(const QString &ifoFilename)
 
     m_dictData.clear();
     m_dict.setFileName(dictFilename);
-    if (m_dict.open(QIODevice::ReadOnly)) return true;
+    if (m_dict.open(QIODevice::ReadOnly)) {
+        // plain DICT is mapped once, articles are served as views into the mapping
+        m_dictData.mappedSize = m_dict.size();
+        m_dictData.mapped = m_dict.map(0,m_dictData.mappedSize);
+        if (m_dictData.mapped == nullptr)
+            m_dictData.mappedSize = 0L;
+        return true;
+    }
 
     m_dict.setFileName(dzDictFilename);
     if (!m_dict.open(QIODevice::ReadOnly)) {
@@ -194,178 +580,446 @@ bool ZStardictDictionary::loadStardictDict(const QString &ifoFilename)
 
 QStringList ZStardictDictionary::wordLookup(const QString& word,
                                             bool suppressMultiforms,
-                                            int maxLookupWords)
+                                            int maxLookupWords,
+                                            const QString& startAfter)
 {
     QStringList res;
     if (isStopRequested())
         return res;
 
-    QList<quint64> usedArticles;
-    auto it = std::as_const(m_index).lowerBound(word);
+    // [begin, end) range of keys with the given prefix
+    const QByteArray prefix = word.toUtf8();
+    int pos = m_index.lowerBound(prefix);
+    const int end = m_index.prefixUpperBound(prefix);
+    if (!startAfter.isEmpty())
+        pos = qMax(pos,m_index.upperBound(startAfter.toUtf8()));
+
+    QSet<quint32> usedArticles;
+    QByteArray lastAdded;
+    bool added = false;
+    ZStardictKeyCursor cursor(&m_index);
+    for (bool valid = cursor.seek(pos);
+         valid && (cursor.pos() < end) && (res.count()<maxLookupWords) && (!isStopRequested());
+         valid = cursor.next()) {
+        if (suppressMultiforms) {
+            const quint32 entry = m_index.entry(cursor.pos());
+            if (usedArticles.contains(entry))
+                continue;
+            usedArticles.insert(entry);
+        }
+
+        // homonyms are stored as separate keys, list them once
+        const auto len = static_cast<int>(cursor.length());
+        if (added && (lastAdded.size() == len) && (memcmp(lastAdded.constData(),cursor.data(),len) == 0))
+            continue;
 
-    if (it == m_index.constEnd()) return res;
-    if (!it.key().startsWith(word)) // nothing similar found in sorted key list
+        res.append(QString::fromUtf8(cursor.data(),len));
+        lastAdded = QByteArray(cursor.data(),len);
+        added = true;
+    }
+
+    return res;
+}
+
+QVector<QPair<QString,int> > ZStardictDictionary::fuzzyLookup(const QString &word,
+                                                              int maxDistance,
+                                                              int maxLookupWords,
+                                                              const QDeadlineTimer &deadline,
+                                                              const std::function<bool ()> &isCancelled)
+{
+    QVector<QPair<QString,int> > res;
+    if (isStopRequested() || word.isEmpty())
         return res;
 
-    while ((it != m_index.constEnd()) && (res.count()<maxLookupWords) && (!isStopRequested())) {
-        if (it.key().startsWith(word)) {
-            if (!suppressMultiforms || !usedArticles.contains(it.value().first)) {
-                res.append(it.key());
-                if (suppressMultiforms)
-                    usedArticles.append(it.value().first);
-            }
-        }
-        it++;
+    auto matches = m_index.fuzzyMatches(word.toUcs4(),maxDistance,[this,&deadline,&isCancelled]{
+        return (isStopRequested() || deadline.hasExpired() || (isCancelled && isCancelled()));
+    });
+    if (isCancelled && isCancelled())
+        return res;
+
+    // best matches first, key order within the same distance, homonyms are adjacent
+    std::stable_sort(matches.begin(),matches.end(),[](const QPair<int,int>& a, const QPair<int,int>& b){
+        return (a.first < b.first);
+    });
+
+    for (const auto &match : std::as_const(matches)) {
+        if (res.count() >= maxLookupWords) break;
+        const QString key = m_index.key(match.second);
+        if (!res.isEmpty() && (res.constLast().first == key))
+            continue;
+
+        res.append(qMakePair(key,match.first));
     }
 
     return res;
 }
 
-QString ZStardictDictionary::handleResource(QChar type, const char *data, quint32 size)
+QStringList ZStardictDictionary::substringLookup(const QString &word, int maxLookupWords,
+                                                 const std::function<bool ()> &isCancelled)
+{
+    QStringList res;
+    if (isStopRequested() || word.isEmpty())
+        return res;
+
+    m_substringIndexMutex.lock();
+    QSharedPointer<const ZStardictSubstringIndex> substringIndex = m_substringIndex;
+    m_substringIndexMutex.unlock();
+    if (substringIndex.isNull()) // not built yet, full scan
+        substringIndex.reset(new ZStardictSubstringIndex());
+
+    const QVector<int> positions = substringIndex->lookup(m_index,word.toUtf8(),maxLookupWords,[this,&isCancelled]{
+        return (isStopRequested() || (isCancelled && isCancelled()));
+    });
+    if (isCancelled && isCancelled())
+        return res;
+
+    res.reserve(positions.count());
+    for (const int pos : positions)
+        res.append(m_index.key(pos));
+
+    return res;
+}
+
+bool ZStardictDictionary::buildSubstringIndex()
 {
-    if (type == QChar(u'x')) // Xdxf content
-        return ZDictConversions::xdxf2Html(QString::fromUtf8(data,size));
+    if (!isReady()) return false;
 
-    if ((type == QChar(u'h') || (type == QChar(u'g')))) // Html content or Pango markup
-        return QString::fromUtf8(data, size );
+    m_substringIndexMutex.lock();
+    const bool built = !m_substringIndex.isNull();
+    m_substringIndexMutex.unlock();
+    if (built) return true;
 
-    if (type == QChar(u'm')) // Pure meaning, usually means preformatted text
-        return ZDictConversions::htmlPreformat(QString::fromUtf8(data,size));
+    QSharedPointer<ZStardictSubstringIndex> substringIndex(new ZStardictSubstringIndex());
+    if (!substringIndex->build(m_index,[]{ return QCoreApplication::closingDown(); }))
+        return false;
 
-    if (type == QChar(u'l')) // Same as 'm', but not in utf8, instead in current locale's
-        return ZDictConversions::htmlPreformat(QString::fromLocal8Bit(data,size));
+    QMutexLocker locker(&m_substringIndexMutex);
+    m_substringIndex = substringIndex;
+    return true;
+}
 
-    if (type.isLower()) {
-        return ZDQSL("<b>Unsupported textual entry type '%1': %2.</b><br>" )
-                .arg(type).arg(QString::fromUtf8(data,size).toHtmlEscaped());
+void ZStardictDictionary::handleResource(QChar type, const char *data, quint32 size, QString *out)
+{
+    if (type == QChar(u'x')) { // Xdxf content
+        out->append(ZDictConversions::xdxf2Html(QString::fromUtf8(data,size)));
+    } else if ((type == QChar(u'h') || (type == QChar(u'g')))) { // Html content or Pango markup
+        out->append(QUtf8StringView(data,size));
+    } else if (type == QChar(u'm')) { // Pure meaning, usually means preformatted text
+        ZDictConversions::htmlPreformatUtf8(data,size,out);
+    } else if (type == QChar(u'l')) { // Same as 'm', but not in utf8, instead in current locale's
+        out->append(ZDictConversions::htmlPreformat(QString::fromLocal8Bit(data,size)));
+    } else if (type.isLower()) {
+        out->append(ZDQSL("<b>Unsupported textual entry type '%1': %2.</b><br>" )
+                    .arg(type).arg(QString::fromUtf8(data,size).toHtmlEscaped()));
+    } else {
+        out->append(ZDQSL("<b>Unsupported blob entry type '%1'.</b><br>" ).arg(type));
     }
+}
 
-    return ZDQSL("<b>Unsupported blob entry type '%1'.</b><br>" ).arg(type);
+void ZStardictDictionary::handleResourceUtf8(QChar type, const char *data, quint32 size, QByteArray *out)
+{
+    if ((type == QChar(u'h') || (type == QChar(u'g')))) { // Html content or Pango markup, passed as is
+        out->append(data,size);
+    } else if (type == QChar(u'm')) {
+        ZDictConversions::htmlPreformatUtf8(data,size,out);
+    } else {
+        QString text;
+        handleResource(type,data,size,&text);
+        out->append(text.toUtf8());
+    }
 }
 
-QString ZStardictDictionary::loadArticle(const QString &word)
+QString ZStardictDictionary::renderArticle(const QByteArray &article) const
 {
     QString res;
+    res.reserve(article.size() + article.size() / 4);
+    parseArticle(article.constData(),static_cast<quint32>(article.size()),
+                 [&res](QChar type, const char* data, quint32 size){
+        handleResource(type,data,size,&res);
+    });
+    return res;
+}
 
-    const auto idxList = m_index.values(word); // NOLINT
-    for (const auto& idx : idxList) {
-        if (isStopRequested())
-            return res;
+QByteArray ZStardictDictionary::renderArticleUtf8(const QByteArray &article) const
+{
+    QByteArray res;
+    res.reserve(article.size() + article.size() / 4);
+    parseArticle(article.constData(),static_cast<quint32>(article.size()),
+                 [&res](QChar type, const char* data, quint32 size){
+        handleResourceUtf8(type,data,size,&res);
+    });
+    return res;
+}
 
-        if (!res.isEmpty())
-            res.append(ZDQSL("<br/><b>%1</b>").arg(word));
+void ZStardictDictionary::parseArticle(const char *data, quint32 size,
+                                       const std::function<void (QChar, const char *, quint32)> &segment) const
+{
+    const auto *it = data;
 
-        quint64 offset = idx.first;
-        quint32 size = idx.second;
+    if (!m_sameTypeSequence.isEmpty()) {
+        for (int seq=0; seq<m_sameTypeSequence.length(); seq++) {
+            bool entrySizeKnown = (seq == (m_sameTypeSequence.length() - 1));
 
-        QByteArray article = dictZipRead(&m_dict,&m_dictData,offset,size);
+            uint32_t entrySize = 0;
 
-        QString articleText;
-        const auto *it = article.constBegin();
+            if (entrySizeKnown) {
+                entrySize = size;
+            } else if (size == 0) {
+                qWarning() << "Short entry for the word encountered";
+                break;
+            }
 
-        if (!m_sameTypeSequence.isEmpty()) {
-            for (int seq=0; seq<m_sameTypeSequence.length(); seq++) {
-                bool entrySizeKnown = (seq == (m_sameTypeSequence.length() - 1));
+            QChar type = m_sameTypeSequence.at(seq);
 
-                uint32_t entrySize = 0;
+            if (type.isLower()) {
+                // Zero-terminated entry, unless it's the last one
+                if (!entrySizeKnown)
+                    entrySize = qstrnlen(it,size);
 
-                if (entrySizeKnown) {
-                    entrySize = size;
-                } else if (size == 0) {
-                    qWarning() << "Short entry for the word encountered";
+                if ((size < entrySize) || (!entrySizeKnown && (size == entrySize))) {
+                    qWarning() << "Malformed entry for the word encountered. ";
                     break;
                 }
 
-                QChar type = m_sameTypeSequence.at(seq);
+                segment(type,it,entrySize);
 
-                if (type.isLower()) {
-                    // Zero-terminated entry, unless it's the last one
-                    if (!entrySizeKnown)
-                        entrySize = strlen(it);
+                if ( !entrySizeKnown )
+                    ++entrySize; // Need to skip the zero byte
+                it += entrySize;
+                size -= entrySize;
 
-                    if (size < entrySize) {
-                        qWarning() << "Malformed entry for the word encountered. ";
+            } else if (type.isUpper()) {
+                // An entry which has its size before contents, unless it's the last one
+                if (!entrySizeKnown) {
+                    if (size < sizeof(quint32)) {
+                        qWarning() << "Malformed entry for the word encountered";
                         break;
                     }
 
-                    articleText += handleResource( type, it, entrySize );
-
-                    if ( !entrySizeKnown )
-                        ++entrySize; // Need to skip the zero byte
-                    it += entrySize;
-                    size -= entrySize;
+                    entrySize = be32toh(*(reinterpret_cast<quint32*>(const_cast<char*>(it))));
+                    it += sizeof(quint32);
+                    size -= sizeof( quint32 );
+                }
 
-                } else if (type.isUpper()) {
-                    // An entry which has its size before contents, unless it's the last one
-                    if (!entrySizeKnown) {
-                        if (size < sizeof(quint32)) {
-                            qWarning() << "Malformed entry for the word encountered";
-                            break;
-                        }
+                if ( size < entrySize ) {
+                    qWarning() << "Malformed entry for the word encountered: ";
+                    break;
+                }
 
-                        entrySize = be32toh(*(reinterpret_cast<quint32*>(const_cast<char*>(it))));
-                        it += sizeof(quint32);
-                        size -= sizeof( quint32 );
-                    }
+                segment(type,it,entrySize);
+                it += entrySize;
+                size -= entrySize;
+            } else {
+                qWarning() << "Non-alpha entry type " << type;
+                break;
+            }
+        }
+    } else {
+        // The sequence is stored in each article separately
+        while (size>0)
+        {
+            QChar type(*it);
+            if (type.isLower()) {
+                // Zero-terminated entry
+                size_t len = qstrnlen(it + 1,size - 1);
+
+                if (size < len + 2) {
+                    qWarning() << "Malformed entry for the word encountered";
+                    break;
+                }
 
-                    if ( size < entrySize ) {
-                        qWarning() << "Malformed entry for the word encountered: ";
-                        break;
-                    }
+                segment(QChar::fromLatin1(*it),it + 1,static_cast<quint32>(len));
+                it += len + 2;
+                size -= len + 2;
+            } else if (type.isUpper()) {
+                // An entry which havs its size before contents
+                if ( size < sizeof(quint32) + 1 ) {
+                    qWarning() << "Malformed entry for the word encountered:";
+                    break;
+                }
 
-                    articleText += handleResource( type, it, entrySize );
-                    it += entrySize;
-                    size -= entrySize;
-                } else {
-                    qWarning() << "Non-alpha entry type " << type;
+                quint32 entrySize = be32toh(*(reinterpret_cast<quint32*>(const_cast<char*>(it+1))));
+                if (size < sizeof( uint32_t ) + 1 + entrySize) {
+                    qWarning() << "Malformed entry for the word encountered";
                     break;
                 }
+
+                segment(QChar::fromLatin1(*it),it + 1 + sizeof( uint32_t ),entrySize);
+                it += sizeof( uint32_t ) + 1 + entrySize;
+                size -= sizeof( uint32_t ) + 1 + entrySize;
+            } else {
+                qWarning() << "Non-alpha entry type encountered " << type;
+                break;
             }
-        } else {
-            // The sequence is stored in each article separately
-            while (size>0)
-            {
-                QChar type(*it);
-                if (type.isLower()) {
-                    // Zero-terminated entry
-                    size_t len = strlen(it + 1);
-
-                    if (size < len + 2) {
-                        qWarning() << "Malformed entry for the word encountered";
-                        break;
-                    }
+        }
+    }
+}
 
-                    articleText += handleResource(*it, it + 1, len);
-                    it += len + 2;
-                    size -= len + 2;
-                } else if (type.isUpper()) {
-                    // An entry which havs its size before contents
-                    if ( size < sizeof(quint32) + 1 ) {
-                        qWarning() << "Malformed entry for the word encountered:";
-                        break;
-                    }
+void ZStardictDictionary::dropCachedArticles()
+{
+    if (m_articleCacheId == 0U) return;
+
+    const quint64 id = m_articleCacheId;
+    const auto isOwnArticle = [id](const ZDictArticleCacheKey& key){
+        return (key.dictionaryId == id);
+    };
+    articleCache().removeIf(isOwnArticle);
+    articleUtf8Cache().removeIf(isOwnArticle);
+}
 
-                    quint32 entrySize = be32toh(*(reinterpret_cast<quint32*>(const_cast<char*>(it+1))));
-                    if (size < sizeof( uint32_t ) + 1 + entrySize) {
-                        qWarning() << "Malformed entry for the word encountered";
-                        break;
-                    }
+QString ZStardictDictionary::loadArticle(const QString &word)
+{
+    return loadArticles(QStringList(word)).constFirst();
+}
 
-                    articleText += handleResource( *it, it + 1 + sizeof( uint32_t ), entrySize );
-                    it += sizeof( uint32_t ) + 1 + entrySize;
-                    size -= sizeof( uint32_t ) + 1 + entrySize;
-                } else {
-                    qWarning() << "Non-alpha entry type encountered " << type;
-                    break;
-                }
+QByteArray ZStardictDictionary::loadArticleUtf8(const QString &word)
+{
+    return loadArticlesUtf8(QStringList(word)).constFirst();
+}
+
+QVector<ZDictRawArticle> ZStardictDictionary::loadRawArticles(const QString &word)
+{
+    QVector<ZDictRawArticle> res;
+
+    const QByteArray key = word.toUtf8();
+    QVector<QPair<quint64,quint32> > ranges;
+    QSet<quint32> usedEntries;
+    for (int pos = m_index.lowerBound(key); (pos < m_index.count()) && m_index.equals(pos,key); pos++) {
+        if (usedEntries.contains(m_index.entry(pos)))
+            continue;
+        usedEntries.insert(m_index.entry(pos));
+        ranges.append(qMakePair(m_index.offset(pos),m_index.size(pos)));
+    }
+
+    if (ranges.isEmpty() || isStopRequested())
+        return res;
+
+    // segments are views into article bytes, no conversion here
+    const QVector<QByteArray> articles = dictZipReadBatch(&m_dict,&m_dictData,ranges);
+    res.reserve(articles.count());
+    for (const auto &data : articles) {
+        ZDictRawArticle article;
+        article.dictionaryName = m_name;
+        article.data = data;
+        const char* begin = data.constData();
+        parseArticle(begin,static_cast<quint32>(data.size()),
+                     [&article,begin](QChar type, const char* segmentData, quint32 size){
+            article.segments.append(ZDictArticleSegment(type,segmentData - begin,size));
+        });
+        res.append(article);
+    }
+
+    return res;
+}
+
+QString ZStardictDictionary::renderRawArticle(const ZDictRawArticle &article)
+{
+    QString res;
+    res.reserve(article.data.size() + article.data.size() / 4);
+    for (int i = 0; i < article.segments.count(); i++) {
+        const QByteArrayView data = article.segmentData(i);
+        handleResource(article.segments.at(i).type,data.constData(),static_cast<quint32>(data.size()),&res);
+    }
+    return res;
+}
+
+QByteArray ZStardictDictionary::renderRawArticleUtf8(const ZDictRawArticle &article)
+{
+    QByteArray res;
+    res.reserve(article.data.size() + article.data.size() / 4);
+    for (int i = 0; i < article.segments.count(); i++) {
+        const QByteArrayView data = article.segmentData(i);
+        handleResourceUtf8(article.segments.at(i).type,data.constData(),static_cast<quint32>(data.size()),&res);
+    }
+    return res;
+}
+
+template<typename Text>
+QVector<Text> ZStardictDictionary::loadRenderedArticles(const QStringList &words,
+                                                        Text (ZStardictDictionary::*render)(const QByteArray&) const)
+{
+    QVector<Text> res(words.count());
+    auto &cache = renderedArticleCache(static_cast<Text*>(nullptr));
+
+    // resolve all index hits first, articles of one word keep index order
+    QVector<int> hitWords;
+    QVector<Text> hitArticles;
+    QVector<int> missedHits;
+    QVector<QPair<quint64,quint32> > ranges;
+    QSet<quint32> usedEntries;
+    for (int i = 0; i < words.count(); i++) {
+        const QByteArray key = words.at(i).toUtf8();
+        usedEntries.clear();
+        for (int pos = m_index.lowerBound(key); (pos < m_index.count()) && m_index.equals(pos,key); pos++) {
+            // headword token and synonym may point to the same entry
+            if (usedEntries.contains(m_index.entry(pos)))
+                continue;
+            usedEntries.insert(m_index.entry(pos));
+
+            // rendered articles are cached, only misses are read and rendered
+            Text article;
+            const quint64 offset = m_index.offset(pos);
+            const quint32 size = m_index.size(pos);
+            if (!cache.find(ZDictArticleCacheKey(m_articleCacheId,offset,size,0U),&article)) {
+                missedHits.append(static_cast<int>(hitWords.count()));
+                ranges.append(qMakePair(offset,size));
             }
+            hitWords.append(i);
+            hitArticles.append(article);
         }
+    }
+
+    if (hitWords.isEmpty() || isStopRequested())
+        return res;
+
+    if (!ranges.isEmpty()) {
+        const QVector<QByteArray> articles = dictZipReadBatch(&m_dict,&m_dictData,ranges);
+        for (int i = 0; i < articles.count(); i++) {
+            if (isStopRequested())
+                return res;
 
-        res += articleText;
+            Text article = (this->*render)(articles.at(i));
+            cache.insert(ZDictArticleCacheKey(m_articleCacheId,ranges.at(i).first,ranges.at(i).second,0U),
+                         article,renderedArticleCost(article));
+            hitArticles[missedHits.at(i)] = article;
+        }
+    }
+
+    // homonym articles are separated by the word, each result is allocated once
+    QVector<Text> separators(words.count());
+    QVector<qsizetype> lengths(words.count(),0);
+    for (int i = 0; i < hitWords.count(); i++) {
+        const int wordIdx = hitWords.at(i);
+        if (lengths.at(wordIdx) > 0) {
+            if (separators.at(wordIdx).isEmpty())
+                separators[wordIdx] = renderedWordSeparator(words.at(wordIdx),static_cast<Text*>(nullptr));
+            lengths[wordIdx] += separators.at(wordIdx).size();
+        }
+        lengths[wordIdx] += hitArticles.at(i).size();
+    }
+    for (int i = 0; i < words.count(); i++)
+        res[i].reserve(lengths.at(i));
+
+    for (int i = 0; i < hitWords.count(); i++) {
+        const int wordIdx = hitWords.at(i);
+        Text &text = res[wordIdx];
+        if (!text.isEmpty())
+            text.append(separators.at(wordIdx));
+
+        text.append(hitArticles.at(i));
     }
 
     return res;
+}
 
+QStringList ZStardictDictionary::loadArticles(const QStringList &words)
+{
+    return loadRenderedArticles<QString>(words,&ZStardictDictionary::renderArticle);
+}
+
+QByteArrayList ZStardictDictionary::loadArticlesUtf8(const QStringList &words)
+{
+    return loadRenderedArticles<QByteArray>(words,&ZStardictDictionary::renderArticleUtf8);
 }
 
 }
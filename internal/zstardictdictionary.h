@@ -1,21 +1,60 @@
 #ifndef ZSTARDICTDICTIONARY_H
 #define ZSTARDICTDICTIONARY_H
 
+#include <functional>
 #include <QStringList>
-#include <QMultiMap>
+#include <QByteArrayList>
 #include <QVector>
+#include <QSharedPointer>
+#include <QMutex>
 #include "zdictionary.h"
 #include "zdictcompress.h"
+#include "zdictlrucache.h"
+#include "zstardictindex.h"
+#include "zstardictsubstringindex.h"
 
 namespace ZDict {
 
-using ZStardictIndex = QMultiMap<QString,QPair<quint64,quint32> >;
+class ZDictArticleCacheKey
+{
+public:
+    quint64 dictionaryId { 0U };
+    quint64 offset { 0U };
+    quint32 size { 0U };
+    quint32 options { 0U }; // render options, for different representations of one article
+
+    ZDictArticleCacheKey() = default;
+    ZDictArticleCacheKey(quint64 aDictionaryId, quint64 aOffset, quint32 aSize, quint32 aOptions)
+        : dictionaryId(aDictionaryId), offset(aOffset), size(aSize), options(aOptions) {}
+    bool operator==(const ZDictArticleCacheKey& other) const {
+        return (dictionaryId == other.dictionaryId) && (offset == other.offset) &&
+                (size == other.size) && (options == other.options);
+    }
+};
+
+inline size_t qHash(const ZDictArticleCacheKey& key, size_t seed = 0)
+{
+    return qHashMulti(seed,key.dictionaryId,key.offset,key.size,key.options);
+}
+
+using ZDictArticleCache = ZDictLruCache<ZDictArticleCacheKey,QString>; // rendered HTML, cost in bytes
+using ZDictArticleUtf8Cache = ZDictLruCache<ZDictArticleCacheKey,QByteArray>; // rendered UTF-8 HTML
+
+const qint64 defaultArticleCacheSize = 16 * 1024 * 1024;
+
+ZDictArticleCache& articleCache();
+ZDictArticleUtf8Cache& articleUtf8Cache();
 
 class ZStardictDictionary : public ZDictionary
 {
     friend class ZDictController;
 private:
     ZStardictIndex m_index;
+    QSharedPointer<const ZStardictSubstringIndex> m_substringIndex;
+    QMutex m_substringIndexMutex;
+    quint64 m_articleCacheId { 0U }; // new id for every indexes load, old cached articles are never hit
+    qint64 m_indexLoadTimeMS { -1L };
+    bool m_indexFromCache { false };
 
     QFile m_dict;
     DictFileData m_dictData;
@@ -23,12 +62,36 @@ private:
     QString m_name;
     QString m_description;
     int m_wordCount { -1 };
+    int m_synWordCount { 0 };
     QString m_sameTypeSequence;
     bool m_64bitOffset { false };
+    unsigned int m_idxFileSize { 0U };
+    QString m_ifoFilename;
+    QString m_filesFingerprint;
+    QString m_indexCacheDirectory;
 
+    QString idxFilename(const QString& ifoFilename) const;
+    QString synFilename(const QString& ifoFilename) const;
+    QStringList existingFiles(const QString& ifoFilename) const;
+    QString filesFingerprint(const QString& ifoFilename) const;
+    QString indexCacheFilename(const QString& ifoFilename) const;
+    int parseIndexSegment(const char* begin, const char* end, ZStardictIndexBuilder* tokens) const;
+    int parseSynonymSegment(const char* begin, const char* end, quint32 entryCount,
+                            ZStardictIndexBuilder* tokens) const;
     bool loadStardictIndex(const QString& ifoFilename, unsigned int expectedIndexFileSize);
     bool loadStardictDict(const QString& ifoFilename);
-    QString handleResource(QChar type, const char *data, quint32 size);
+    // Calls segment for each typed field of article, by sametypesequence or per-article types
+    void parseArticle(const char* data, quint32 size,
+                      const std::function<void(QChar type, const char* data, quint32 size)>& segment) const;
+    static void handleResource(QChar type, const char *data, quint32 size, QString* out);
+    static void handleResourceUtf8(QChar type, const char *data, quint32 size, QByteArray* out);
+    QString renderArticle(const QByteArray& article) const;
+    QByteArray renderArticleUtf8(const QByteArray& article) const;
+    template<typename Text>
+    QVector<Text> loadRenderedArticles(const QStringList& words,
+                                       Text (ZStardictDictionary::*render)(const QByteArray&) const);
+    void dropCachedArticles();
+    void closeDict();
 
 public:
     ZStardictDictionary();
@@ -36,15 +99,42 @@ public:
     ZStardictDictionary(const ZStardictDictionary& other) = delete;
     ZStardictDictionary& operator = (const ZStardictDictionary &t) = delete;
 
+    void setIndexCacheDirectory(const QString& path);
+    qint64 indexMemoryUsage() const { return m_index.memoryUsage(); } // compiled index image, mapped or in memory
+    const ZStardictIndex& index() const { return m_index; } // valid while dictionary is ready and not evicted
+
 protected:
-    bool loadIndexes(const QString& indexFile) override;
+    bool loadInfo(const QString& infoFile) override;
+    bool loadIndexes() override;
     QStringList wordLookup(const QString& word,
                            bool suppressMultiforms = false,
-                           int maxLookupWords = defaultMaxLookupWords) override;
+                           int maxLookupWords = defaultMaxLookupWords,
+                           const QString& startAfter = QString()) override;
+    QVector<QPair<QString,int> > fuzzyLookup(const QString& word,
+                                             int maxDistance,
+                                             int maxLookupWords,
+                                             const QDeadlineTimer& deadline,
+                                             const std::function<bool()>& isCancelled = nullptr) override;
+    QStringList substringLookup(const QString& word, int maxLookupWords,
+                                const std::function<bool()>& isCancelled = nullptr) override;
+    bool buildSubstringIndex() override;
     QString loadArticle(const QString& word) override;
+    QStringList loadArticles(const QStringList& words) override;
+    QByteArray loadArticleUtf8(const QString& word) override;
+    QByteArrayList loadArticlesUtf8(const QStringList& words) override;
+    QVector<ZDictRawArticle> loadRawArticles(const QString& word) override;
+    QString renderRawArticle(const ZDictRawArticle& article) override;
+    QByteArray renderRawArticleUtf8(const ZDictRawArticle& article) override;
     QString getName() override { return m_name; };
     QString getDescription() override { return m_description; };
     int getWordCount() override { return m_wordCount; };
+    QString getInfoFile() override { return m_ifoFilename; };
+    bool isModified() override;
+    QStringList getFiles() override;
+    void removeIndexCache() override;
+    ZDictDictionaryMetrics getMetrics() override;
+    qint64 memoryUsage() override;
+    void releaseIndexes() override;
 
 };
 
@@ -0,0 +1,703 @@
+#include <algorithm>
+#include <execution>
+#include <cstring>
+#include <limits>
+
+#include <QSaveFile>
+#include "zstardictindex.h"
+
+#include <QDebug>
+
+namespace {
+
+const char indexMagic[] = "ZDICTIDX";
+const quint32 indexVersion = 4U;
+const int maxKeyBlockSize = 1024;
+
+class ZStardictIndexHeader
+{
+public:
+    char magic[8];
+    quint32 version;
+    quint32 count;
+    quint32 entryCount;
+    quint32 keyBlockSize;
+    qint64 ifoSize;
+    qint64 ifoModified;
+    qint64 idxSize;
+    qint64 idxModified;
+    qint64 synSize;
+    qint64 synModified;
+    quint64 entryOffsetsOffset;
+    quint64 entrySizesOffset;
+    quint64 entryIdsOffset;
+    quint64 blockOffsetsOffset;
+    quint64 keysOffset;
+    quint64 keysSize;
+};
+
+// Decodes one UTF-8 sequence, returns its length, invalid bytes are decoded one by one
+int decodeUtf8(const char* data, const char* end, uint* ucs4)
+{
+    const auto lead = static_cast<uchar>(*data);
+    int len = 1;
+    uint res = lead;
+    if (lead >= 0xF0U) {
+        len = 4;
+        res = lead & 0x07U;
+    } else if (lead >= 0xE0U) {
+        len = 3;
+        res = lead & 0x0FU;
+    } else if (lead >= 0xC0U) {
+        len = 2;
+        res = lead & 0x1FU;
+    }
+    if ((len > 1) && (end - data >= len)) {
+        for (int i = 1; i < len; i++) {
+            const auto c = static_cast<uchar>(data[i]);
+            if ((c & 0xC0U) != 0x80U) {
+                *ucs4 = lead;
+                return 1;
+            }
+            res = (res << 6U) | (c & 0x3FU);
+        }
+        *ucs4 = res;
+        return len;
+    }
+    *ucs4 = lead;
+    return 1;
+}
+
+void appendVarint(QByteArray* out, quint32 value)
+{
+    while (value >= 0x80U) {
+        out->append(static_cast<char>((value & 0x7FU) | 0x80U));
+        value >>= 7U;
+    }
+    out->append(static_cast<char>(value));
+}
+
+quint32 readVarint(const char** it)
+{
+    quint32 res = 0U;
+    int shift = 0;
+    for (;;) {
+        const auto byte = static_cast<quint8>(**it);
+        (*it)++;
+        res |= static_cast<quint32>(byte & 0x7FU) << shift;
+        if ((byte & 0x80U) == 0U)
+            break;
+        shift += 7;
+    }
+    return res;
+}
+
+// Bounds checked variant for cache validation, at most 5 bytes for quint32
+bool readVarint(const char** it, const char* end, quint32* value)
+{
+    quint32 res = 0U;
+    for (int shift = 0; (shift < 35) && (*it < end); shift += 7) {
+        const auto byte = static_cast<quint8>(**it);
+        (*it)++;
+        res |= static_cast<quint32>(byte & 0x7FU) << shift;
+        if ((byte & 0x80U) == 0U) {
+            *value = res;
+            return true;
+        }
+    }
+    return false;
+}
+
+int compareKeys(const char* a, quint32 aLength, const char* b, quint32 bLength)
+{
+    const int res = memcmp(a,b,qMin(aLength,bLength));
+    if (res != 0) return res;
+    if (aLength < bLength) return -1;
+    if (aLength > bLength) return 1;
+    return 0;
+}
+
+}
+
+namespace ZDict {
+
+void ZStardictIndexBuilder::reserve(int tokenCount, int arenaSize, int entryCount)
+{
+    m_tokens.reserve(tokenCount);
+    m_arena.reserve(arenaSize);
+    m_entryOffsets.reserve(entryCount);
+    m_entrySizes.reserve(entryCount);
+}
+
+quint32 ZStardictIndexBuilder::addEntry(quint64 offset, quint32 size)
+{
+    m_entryOffsets.append(offset);
+    m_entrySizes.append(size);
+    return m_entryBase + static_cast<quint32>(m_entryOffsets.count() - 1);
+}
+
+void ZStardictIndexBuilder::add(const char *key, int keyLength, quint32 entry)
+{
+    Token token {};
+    token.entry = entry;
+    token.keyOffset = static_cast<quint32>(m_arena.size());
+    token.keyLength = static_cast<quint32>(keyLength);
+    m_arena.append(key,keyLength);
+    m_tokens.append(token);
+}
+
+void ZStardictIndexBuilder::setEntryBase(quint32 base)
+{
+    for (auto &token : m_tokens)
+        token.entry = token.entry - m_entryBase + base;
+    m_entryBase = base;
+}
+
+void ZStardictIndexBuilder::clear()
+{
+    m_tokens.clear();
+    m_arena.clear();
+    m_entryOffsets.clear();
+    m_entrySizes.clear();
+    m_entryBase = 0U;
+}
+
+ZStardictKeyCursor::ZStardictKeyCursor(const ZStardictIndex *index)
+    : m_index(index)
+{
+}
+
+void ZStardictKeyCursor::decodeNext()
+{
+    const quint32 shared = readVarint(&m_next);
+    const quint32 suffix = readVarint(&m_next);
+    m_key.resize(shared);
+    m_key.append(m_next,suffix);
+    m_next += suffix;
+    m_shared = shared;
+    m_pos++;
+}
+
+bool ZStardictKeyCursor::seek(int pos)
+{
+    if ((pos < 0) || (pos >= m_index->m_count))
+        return false;
+
+    const int blockSize = m_index->m_keyBlockSize;
+    if ((m_pos < 0) || (pos < m_pos) || ((pos / blockSize) != (m_pos / blockSize))) {
+        const int block = pos / blockSize;
+        m_next = m_index->m_keys + m_index->m_blockOffsets[block];
+        m_pos = block * blockSize - 1;
+    }
+    while (m_pos < pos)
+        decodeNext();
+    return true;
+}
+
+bool ZStardictKeyCursor::next()
+{
+    if ((m_pos < 0) || (m_pos + 1 >= m_index->m_count))
+        return false;
+
+    if (((m_pos + 1) % m_index->m_keyBlockSize) != 0) {
+        decodeNext();
+        return true;
+    }
+
+    // block head is stored whole, count the prefix shared with the current key
+    const char* head = m_next;
+    readVarint(&head);
+    const quint32 headLength = readVarint(&head);
+    const quint32 limit = qMin(headLength,length());
+    quint32 common = 0U;
+    while ((common < limit) && (head[common] == m_key.at(common)))
+        common++;
+    decodeNext();
+    m_shared = common;
+    return true;
+}
+
+ZStardictIndex::~ZStardictIndex()
+{
+    clear();
+}
+
+void ZStardictIndex::clear()
+{
+    if (isMapped())
+        m_mappedFile.unmap(const_cast<uchar*>(m_data));
+    if (m_mappedFile.isOpen())
+        m_mappedFile.close();
+
+    m_image.clear();
+    m_data = nullptr;
+    m_dataSize = 0L;
+    m_entryOffsets = nullptr;
+    m_entrySizes = nullptr;
+    m_entryIds = nullptr;
+    m_blockOffsets = nullptr;
+    m_keys = nullptr;
+    m_count = 0;
+    m_entryCount = 0;
+    m_blockCount = 0;
+    m_keyBlockSize = 1;
+}
+
+bool ZStardictIndex::attach(const uchar *data, qint64 size)
+{
+    if ((data == nullptr) || (size < static_cast<qint64>(sizeof(ZStardictIndexHeader))))
+        return false;
+
+    const auto *header = reinterpret_cast<const ZStardictIndexHeader*>(data);
+    if ((memcmp(header->magic,indexMagic,sizeof(header->magic)) != 0) ||
+            (header->version != indexVersion)) {
+        return false;
+    }
+
+    const quint64 count = header->count;
+    const quint64 entryCount = header->entryCount;
+    const quint64 blockSize = header->keyBlockSize;
+    const auto fileSize = static_cast<quint64>(size);
+    if ((count >= static_cast<quint64>(std::numeric_limits<int>::max())) ||
+            (entryCount > static_cast<quint64>(std::numeric_limits<int>::max())) ||
+            (blockSize == 0U) || (blockSize > static_cast<quint64>(maxKeyBlockSize))) {
+        qWarning() << "Stardict: broken compiled index.";
+        return false;
+    }
+    const quint64 blockCount = (count + blockSize - 1U) / blockSize;
+    if ((header->entrySizesOffset > fileSize) || (header->entryIdsOffset > fileSize) ||
+            (header->blockOffsetsOffset > fileSize) || (header->keysOffset > fileSize) ||
+            (header->keysSize > fileSize) ||
+            (header->entryOffsetsOffset < sizeof(ZStardictIndexHeader)) ||
+            ((header->entryOffsetsOffset + entryCount * sizeof(quint64)) > header->entrySizesOffset) ||
+            ((header->entrySizesOffset + entryCount * sizeof(quint32)) > header->entryIdsOffset) ||
+            ((header->entryIdsOffset + count * sizeof(quint32)) > header->blockOffsetsOffset) ||
+            ((header->blockOffsetsOffset + (blockCount + 1) * sizeof(quint32)) > header->keysOffset) ||
+            ((header->keysOffset + header->keysSize) > fileSize)) {
+        qWarning() << "Stardict: broken compiled index.";
+        return false;
+    }
+
+    // one linear pass decoding every key, so lookups on a corrupt cache file never read outside the image
+    const auto *entryIds = reinterpret_cast<const quint32*>(data + header->entryIdsOffset);
+    const auto *blockOffsets = reinterpret_cast<const quint32*>(data + header->blockOffsetsOffset);
+    const auto *keys = reinterpret_cast<const char*>(data + header->keysOffset);
+    bool valid = (blockOffsets[0] == 0U) && (blockOffsets[blockCount] == header->keysSize);
+    for (quint64 i = 0; valid && (i < count); i++)
+        valid = (entryIds[i] < entryCount);
+    for (quint64 block = 0; valid && (block < blockCount); block++) {
+        valid = (blockOffsets[block] <= blockOffsets[block + 1]);
+        const char* it = keys + blockOffsets[block];
+        const char* end = keys + (valid ? blockOffsets[block + 1] : blockOffsets[block]);
+        const quint64 blockKeys = qMin(blockSize,count - block * blockSize);
+        quint32 prevLength = 0U;
+        for (quint64 i = 0; valid && (i < blockKeys); i++) {
+            quint32 shared = 0U;
+            quint32 suffix = 0U;
+            valid = readVarint(&it,end,&shared) && readVarint(&it,end,&suffix) &&
+                    (shared <= prevLength) && ((i > 0) || (shared == 0U)) &&
+                    (suffix <= static_cast<quint32>(end - it)) &&
+                    (static_cast<quint64>(shared) + suffix < static_cast<quint64>(std::numeric_limits<int>::max()));
+            it += valid ? suffix : 0U;
+            prevLength = shared + suffix;
+        }
+        valid = valid && (it == end);
+    }
+    if (!valid) {
+        qWarning() << "Stardict: broken compiled index.";
+        return false;
+    }
+
+    m_data = data;
+    m_dataSize = size;
+    m_entryOffsets = reinterpret_cast<const quint64*>(data + header->entryOffsetsOffset);
+    m_entrySizes = reinterpret_cast<const quint32*>(data + header->entrySizesOffset);
+    m_entryIds = entryIds;
+    m_blockOffsets = blockOffsets;
+    m_keys = keys;
+    m_count = static_cast<int>(count);
+    m_entryCount = static_cast<int>(entryCount);
+    m_blockCount = static_cast<int>(blockCount);
+    m_keyBlockSize = static_cast<int>(blockSize);
+    return true;
+}
+
+void ZStardictIndex::build(const ZStardictIndexBuilder &builder, const ZStardictIndexFingerprint &fingerprint)
+{
+    build(QVector<ZStardictIndexBuilder>({ builder }),fingerprint);
+}
+
+void ZStardictIndex::build(const QVector<ZStardictIndexBuilder> &builders, const ZStardictIndexFingerprint &fingerprint)
+{
+    clear();
+
+    // token reference is (builder << 32) | token
+    const auto tokenAt = [&builders](quint64 ref) -> const ZStardictIndexBuilder::Token& {
+        return builders.at(static_cast<int>(ref >> 32U)).m_tokens.at(static_cast<int>(ref & 0xffffffffU));
+    };
+    const auto keyAt = [&builders](quint64 ref, const ZStardictIndexBuilder::Token& token) {
+        return builders.at(static_cast<int>(ref >> 32U)).m_arena.constData() + token.keyOffset;
+    };
+    const auto tokenLess = [&tokenAt,&keyAt](quint64 a, quint64 b){
+        const auto &ta = tokenAt(a);
+        const auto &tb = tokenAt(b);
+        return (compareKeys(keyAt(a,ta),ta.keyLength,keyAt(b,tb),tb.keyLength) < 0);
+    };
+
+    QVector<QPair<qsizetype,qsizetype> > runs;
+    quint64 count = 0U;
+    quint64 entryCount = 0U;
+    for (const auto &builder : builders) {
+        runs.append(qMakePair(static_cast<qsizetype>(count),static_cast<qsizetype>(count + builder.count())));
+        count += static_cast<quint64>(builder.count());
+        entryCount = qMax(entryCount,static_cast<quint64>(builder.entryBase()) +
+                          static_cast<quint64>(builder.entryCount()));
+    }
+
+    // sort each builder as a separate run
+    QVector<quint64> order(static_cast<qsizetype>(count));
+    std::for_each(std::execution::par,runs.constBegin(),runs.constEnd(),
+                  [&order,&tokenLess,&runs](const QPair<qsizetype,qsizetype>& run){
+        const auto builderIdx = static_cast<quint64>(&run - runs.constData());
+        for (qsizetype i = run.first; i < run.second; i++)
+            order[i] = (builderIdx << 32U) | static_cast<quint64>(i - run.first);
+        std::stable_sort(order.begin() + run.first,order.begin() + run.second,tokenLess);
+    });
+
+    // pairwise merge of neighbour runs, std::merge is stable, so equal keys keep IDX order
+    QVector<quint64> merged(order.size());
+    while (runs.count() > 1) {
+        QVector<QPair<qsizetype,qsizetype> > mergedRuns;
+        for (int i = 0; i < runs.count(); i += 2) {
+            const auto &left = runs.at(i);
+            if (i + 1 < runs.count()) {
+                const auto &right = runs.at(i + 1);
+                std::merge(std::execution::par,
+                           order.constBegin() + left.first,order.constBegin() + left.second,
+                           order.constBegin() + right.first,order.constBegin() + right.second,
+                           merged.begin() + left.first,tokenLess);
+                mergedRuns.append(qMakePair(left.first,right.second));
+            } else {
+                std::copy(order.constBegin() + left.first,order.constBegin() + left.second,
+                          merged.begin() + left.first);
+                mergedRuns.append(left);
+            }
+        }
+        order.swap(merged);
+        runs.swap(mergedRuns);
+    }
+    merged.clear();
+
+    // keys are front-coded in sorted order, so prefix scans walk them sequentially
+    const quint64 blockSize = ZStardictIndex::defaultKeyBlockSize;
+    const quint64 blockCount = (count + blockSize - 1U) / blockSize;
+    QVector<quint32> blockOffsets;
+    blockOffsets.reserve(static_cast<qsizetype>(blockCount + 1));
+    QByteArray keys;
+    const char* prevKey = nullptr;
+    quint32 prevLength = 0U;
+    for (quint64 i = 0; i < count; i++) {
+        const quint64 ref = order.at(static_cast<qsizetype>(i));
+        const auto &token = tokenAt(ref);
+        const char* key = keyAt(ref,token);
+
+        quint32 shared = 0U;
+        if ((i % blockSize) == 0U) {
+            blockOffsets.append(static_cast<quint32>(keys.size()));
+        } else {
+            const quint32 limit = qMin(token.keyLength,prevLength);
+            while ((shared < limit) && (key[shared] == prevKey[shared]))
+                shared++;
+        }
+        appendVarint(&keys,shared);
+        appendVarint(&keys,token.keyLength - shared);
+        keys.append(key + shared,static_cast<qsizetype>(token.keyLength - shared));
+
+        prevKey = key;
+        prevLength = token.keyLength;
+    }
+    blockOffsets.append(static_cast<quint32>(keys.size()));
+
+    ZStardictIndexHeader header {};
+    memcpy(header.magic,indexMagic,sizeof(header.magic));
+    header.version = indexVersion;
+    header.count = static_cast<quint32>(count);
+    header.entryCount = static_cast<quint32>(entryCount);
+    header.keyBlockSize = static_cast<quint32>(blockSize);
+    header.ifoSize = fingerprint.ifoSize;
+    header.ifoModified = fingerprint.ifoModified;
+    header.idxSize = fingerprint.idxSize;
+    header.idxModified = fingerprint.idxModified;
+    header.synSize = fingerprint.synSize;
+    header.synModified = fingerprint.synModified;
+    header.entryOffsetsOffset = sizeof(ZStardictIndexHeader);
+    header.entrySizesOffset = header.entryOffsetsOffset + entryCount * sizeof(quint64);
+    header.entryIdsOffset = header.entrySizesOffset + entryCount * sizeof(quint32);
+    header.blockOffsetsOffset = header.entryIdsOffset + count * sizeof(quint32);
+    header.keysOffset = header.blockOffsetsOffset + (blockCount + 1) * sizeof(quint32);
+    header.keysSize = static_cast<quint64>(keys.size());
+
+    m_image.resize(static_cast<qsizetype>(header.keysOffset + header.keysSize));
+    char* image = m_image.data();
+    memcpy(image,&header,sizeof(header));
+
+    auto *entryOffsets = reinterpret_cast<quint64*>(image + header.entryOffsetsOffset);
+    auto *entrySizes = reinterpret_cast<quint32*>(image + header.entrySizesOffset);
+    auto *entryIds = reinterpret_cast<quint32*>(image + header.entryIdsOffset);
+
+    memset(entryOffsets,0,entryCount * sizeof(quint64));
+    memset(entrySizes,0,entryCount * sizeof(quint32));
+    for (const auto &builder : builders) {
+        if (builder.entryCount() == 0) continue;
+        memcpy(entryOffsets + builder.entryBase(),builder.m_entryOffsets.constData(),
+               builder.m_entryOffsets.count() * sizeof(quint64));
+        memcpy(entrySizes + builder.entryBase(),builder.m_entrySizes.constData(),
+               builder.m_entrySizes.count() * sizeof(quint32));
+    }
+
+    for (quint64 i = 0; i < count; i++)
+        entryIds[i] = tokenAt(order.at(static_cast<qsizetype>(i))).entry;
+    memcpy(image + header.blockOffsetsOffset,blockOffsets.constData(),
+           static_cast<size_t>(blockOffsets.count()) * sizeof(quint32));
+    memcpy(image + header.keysOffset,keys.constData(),static_cast<size_t>(keys.size()));
+
+    attach(reinterpret_cast<const uchar*>(m_image.constData()),m_image.size());
+}
+
+bool ZStardictIndex::load(const QString &cacheFilename, const ZStardictIndexFingerprint &fingerprint)
+{
+    clear();
+
+    m_mappedFile.setFileName(cacheFilename);
+    if (!m_mappedFile.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 size = m_mappedFile.size();
+    const uchar* data = m_mappedFile.map(0,size);
+    // mapping stays valid after close, don't hold file handles for every dictionary
+    m_mappedFile.close();
+
+    if (data == nullptr)
+        return false;
+
+    if (!attach(data,size)) {
+        m_mappedFile.unmap(const_cast<uchar*>(data));
+        return false;
+    }
+
+    const auto *header = reinterpret_cast<const ZStardictIndexHeader*>(m_data);
+    ZStardictIndexFingerprint cached;
+    cached.ifoSize = header->ifoSize;
+    cached.ifoModified = header->ifoModified;
+    cached.idxSize = header->idxSize;
+    cached.idxModified = header->idxModified;
+    cached.synSize = header->synSize;
+    cached.synModified = header->synModified;
+    if (!(cached == fingerprint)) {
+        clear();
+        return false;
+    }
+
+    return true;
+}
+
+bool ZStardictIndex::save(const QString &cacheFilename) const
+{
+    if (m_image.isEmpty())
+        return false;
+
+    QSaveFile file(cacheFilename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Stardict: unable to create compiled index file" << cacheFilename;
+        return false;
+    }
+    if (file.write(m_image) != m_image.size()) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+qint64 ZStardictIndex::keysMemoryUsage() const
+{
+    if (m_count == 0) return 0L;
+    return static_cast<qint64>(m_blockOffsets[m_blockCount]) +
+            static_cast<qint64>(m_blockCount + 1) * static_cast<qint64>(sizeof(quint32));
+}
+
+const char *ZStardictIndex::blockHead(int block, quint32 *length) const
+{
+    const char* it = m_keys + m_blockOffsets[block];
+    readVarint(&it);
+    *length = readVarint(&it);
+    return it;
+}
+
+template<typename Predicate>
+int ZStardictIndex::partitionPoint(Predicate isBefore) const
+{
+    // binary search over block heads, they are stored whole
+    int first = 0;
+    int len = m_blockCount;
+    while (len > 0) {
+        const int half = len / 2;
+        const int mid = first + half;
+        quint32 headLength = 0U;
+        const char* head = blockHead(mid,&headLength);
+        if (isBefore(head,headLength)) {
+            first = mid + 1;
+            len -= half + 1;
+        } else {
+            len = half;
+        }
+    }
+    if (first == 0)
+        return 0;
+
+    // the point is after the head of the previous block, scan the rest of that block
+    const int blockStart = (first - 1) * m_keyBlockSize;
+    const int blockEnd = qMin(m_count,blockStart + m_keyBlockSize);
+    ZStardictKeyCursor cursor(this);
+    cursor.seek(blockStart);
+    while (cursor.next() && (cursor.pos() < blockEnd)) {
+        if (!isBefore(cursor.data(),cursor.length()))
+            return cursor.pos();
+    }
+    return blockEnd;
+}
+
+int ZStardictIndex::lowerBound(const QByteArray &key) const
+{
+    const auto keyLen = static_cast<quint32>(key.size());
+    return partitionPoint([&key,keyLen](const char* data, quint32 length){
+        return (compareKeys(data,length,key.constData(),keyLen) < 0);
+    });
+}
+
+int ZStardictIndex::upperBound(const QByteArray &key) const
+{
+    const auto keyLen = static_cast<quint32>(key.size());
+    return partitionPoint([&key,keyLen](const char* data, quint32 length){
+        return (compareKeys(data,length,key.constData(),keyLen) <= 0);
+    });
+}
+
+int ZStardictIndex::prefixUpperBound(const QByteArray &prefix) const
+{
+    // keys truncated to the prefix length are still sorted
+    const auto prefixLen = static_cast<quint32>(prefix.size());
+    return partitionPoint([&prefix,prefixLen](const char* data, quint32 length){
+        return (compareKeys(data,qMin(length,prefixLen),prefix.constData(),prefixLen) <= 0);
+    });
+}
+
+bool ZStardictIndex::startsWith(int pos, const QByteArray &prefix) const
+{
+    ZStardictKeyCursor cursor(this);
+    if (!cursor.seek(pos) || (cursor.length() < static_cast<quint32>(prefix.size()))) return false;
+    return (memcmp(cursor.data(),prefix.constData(),prefix.size()) == 0);
+}
+
+bool ZStardictIndex::equals(int pos, const QByteArray &key) const
+{
+    ZStardictKeyCursor cursor(this);
+    if (!cursor.seek(pos) || (cursor.length() != static_cast<quint32>(key.size()))) return false;
+    return (memcmp(cursor.data(),key.constData(),key.size()) == 0);
+}
+
+QString ZStardictIndex::key(int pos) const
+{
+    ZStardictKeyCursor cursor(this);
+    if (!cursor.seek(pos)) return QString();
+    return QString::fromUtf8(cursor.data(),static_cast<int>(cursor.length()));
+}
+
+QVector<QPair<int,int> > ZStardictIndex::fuzzyMatches(const QVector<uint> &query, int maxDistance,
+                                                      const std::function<bool ()> &isCancelled) const
+{
+    const int cancelCheckInterval = 256;
+
+    QVector<QPair<int,int> > res;
+    const auto queryLength = static_cast<int>(query.count());
+    const int rowSize = queryLength + 1;
+
+    /* Sorted keys are walked as an implicit trie. rows[d] is the DP row for the first d code points
+     * of the current key, depthBytes[d] is the byte length of that prefix. Rows are reused for the
+     * prefix shared with the previous key, keys under a prefix that can't match are skipped. */
+    QVector<int> rows(rowSize);
+    QVector<quint32> depthBytes(1,0U);
+    for (int j = 0; j <= queryLength; j++)
+        rows[j] = j;
+
+    ZStardictKeyCursor cursor(this);
+    QByteArray prevKey;
+    bool hasPrev = false;
+    int prevDepth = 0;
+    int iteration = 0;
+    bool valid = cursor.seek(0);
+    while (valid) {
+        if ((++iteration % cancelCheckInterval == 0) && isCancelled && isCancelled())
+            break;
+
+        const char* key = cursor.data();
+        const quint32 len = cursor.length();
+
+        int depth = 0;
+        if (hasPrev) {
+            const quint32 limit = qMin(depthBytes.at(prevDepth),len);
+            quint32 common = 0U;
+            while ((common < limit) && (key[common] == prevKey.at(common)))
+                common++;
+            depth = prevDepth;
+            while ((depth > 0) && (depthBytes.at(depth) > common))
+                depth--;
+        }
+        // cursor reuses its buffer, keep a copy for the next iteration
+        prevKey.resize(static_cast<qsizetype>(len));
+        memcpy(prevKey.data(),key,len);
+        hasPrev = true;
+
+        bool pruned = false;
+        quint32 bytePos = depthBytes.at(depth);
+        while (bytePos < len) {
+            uint ucs4 = 0U;
+            bytePos += static_cast<quint32>(decodeUtf8(key + bytePos,key + len,&ucs4));
+            depth++;
+            if (rows.count() < (depth + 1) * rowSize)
+                rows.resize((depth + 1) * rowSize);
+            if (depthBytes.count() <= depth)
+                depthBytes.resize(depth + 1);
+            depthBytes[depth] = bytePos;
+
+            const int* prevRow = rows.constData() + (depth - 1) * rowSize;
+            int* row = rows.data() + depth * rowSize;
+            row[0] = depth;
+            int rowMin = depth;
+            for (int j = 1; j <= queryLength; j++) {
+                const int cost = (query.at(j - 1) == ucs4) ? 0 : 1;
+                row[j] = qMin(qMin(prevRow[j] + 1,row[j - 1] + 1),prevRow[j - 1] + cost);
+                rowMin = qMin(rowMin,row[j]);
+            }
+            if (rowMin > maxDistance) {
+                pruned = true;
+                break;
+            }
+        }
+        prevDepth = depth;
+
+        if (pruned) {
+            valid = cursor.seek(prefixUpperBound(QByteArray::fromRawData(prevKey.constData(),
+                                                                         static_cast<int>(depthBytes.at(depth)))));
+            continue;
+        }
+
+        const int distance = rows.at(depth * rowSize + queryLength);
+        if (distance <= maxDistance)
+            res.append(qMakePair(distance,cursor.pos()));
+        valid = cursor.next();
+    }
+
+    return res;
+}
+
+}
@@ -0,0 +1,171 @@
+#ifndef ZSTARDICTINDEX_H
+#define ZSTARDICTINDEX_H
+
+#include <functional>
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+namespace ZDict {
+
+class ZStardictIndexFingerprint
+{
+public:
+    qint64 ifoSize { 0L };
+    qint64 ifoModified { 0L };
+    qint64 idxSize { 0L };
+    qint64 idxModified { 0L };
+    qint64 synSize { 0L };
+    qint64 synModified { 0L };
+
+    ZStardictIndexFingerprint() = default;
+    bool operator==(const ZStardictIndexFingerprint& other) const {
+        return (ifoSize == other.ifoSize) && (ifoModified == other.ifoModified) &&
+                (idxSize == other.idxSize) && (idxModified == other.idxModified) &&
+                (synSize == other.synSize) && (synModified == other.synModified);
+    }
+};
+
+/* Unsorted token collector, tokens are appended in IDX order and sorted by ZStardictIndex::build.
+ * Each IDX record is an entry (article offset and size), tokens refer to entries by id,
+ * so all tokens of a headword and its synonyms share one entry.
+ * Entry ids are global: entry base of the builder plus local entry number.
+ * Separate IDX segments may be collected by separate builders in parallel. */
+class ZStardictIndexBuilder
+{
+    friend class ZStardictIndex;
+private:
+    struct Token {
+        quint32 entry;
+        quint32 keyOffset;
+        quint32 keyLength;
+    };
+
+    QVector<Token> m_tokens;
+    QByteArray m_arena;
+    QVector<quint64> m_entryOffsets;
+    QVector<quint32> m_entrySizes;
+    quint32 m_entryBase { 0U };
+
+public:
+    ZStardictIndexBuilder() = default;
+
+    void reserve(int tokenCount, int arenaSize, int entryCount = 0);
+    quint32 addEntry(quint64 offset, quint32 size); // returns global entry id
+    void add(const char* key, int keyLength, quint32 entry);
+    void add(const QByteArray& key, quint32 entry) {
+        add(key.constData(),static_cast<int>(key.size()),entry);
+    }
+    void setEntryBase(quint32 base); // shifts ids of already added tokens too
+    void clear();
+    int count() const { return static_cast<int>(m_tokens.count()); }
+    int entryCount() const { return static_cast<int>(m_entryOffsets.count()); }
+    quint32 entryBase() const { return m_entryBase; }
+
+};
+
+class ZStardictIndex;
+
+/* Sequential reader of front-coded index keys. Moving forward within a block decodes only
+ * the next key, other seeks restart from the block head. Key data is valid until the next move. */
+class ZStardictKeyCursor
+{
+private:
+    const ZStardictIndex* m_index;
+    const char* m_next { nullptr };
+    QByteArray m_key;
+    int m_pos { -1 };
+    quint32 m_shared { 0U };
+
+    void decodeNext();
+
+public:
+    explicit ZStardictKeyCursor(const ZStardictIndex* index);
+
+    bool seek(int pos); // false if pos is out of range
+    bool next(); // false at the last key
+    int pos() const { return m_pos; }
+    const char* data() const { return m_key.constData(); }
+    quint32 length() const { return static_cast<quint32>(m_key.size()); }
+    // Bytes shared with the previous key, block heads reached by seek() report 0
+    quint32 shared() const { return m_shared; }
+
+};
+
+/* Compiled StarDict index.
+ * Struct-of-arrays image: header, entry article offsets (quint64) and sizes (quint32),
+ * key entry ids (quint32), key block offsets (quint32, blockCount+1 items) and front-coded
+ * UTF-8 keys in sorted order. Keys are grouped in blocks of keyBlockSize, each key is stored as
+ * varint length of the prefix shared with the previous key, varint suffix length and the suffix.
+ * Block heads share nothing, binary search runs over them and scans one block sequentially.
+ * Kept either in memory or mapped directly from the on-disk cache file. The image uses native
+ * byte order, cache files are not portable between machines. */
+class ZStardictIndex
+{
+    friend class ZStardictKeyCursor;
+private:
+    QByteArray m_image;
+    QFile m_mappedFile;
+    const uchar* m_data { nullptr };
+    qint64 m_dataSize { 0L };
+    const quint64* m_entryOffsets { nullptr };
+    const quint32* m_entrySizes { nullptr };
+    const quint32* m_entryIds { nullptr };
+    const quint32* m_blockOffsets { nullptr };
+    const char* m_keys { nullptr };
+    int m_count { 0 };
+    int m_entryCount { 0 };
+    int m_blockCount { 0 };
+    int m_keyBlockSize { 1 };
+
+    bool attach(const uchar* data, qint64 size);
+
+public:
+    static const int defaultKeyBlockSize = 16;
+
+    ZStardictIndex() = default;
+    ~ZStardictIndex();
+    ZStardictIndex(const ZStardictIndex& other) = delete;
+    ZStardictIndex& operator = (const ZStardictIndex &t) = delete;
+
+    void clear();
+    bool isEmpty() const { return (m_count == 0); }
+    int count() const { return m_count; }
+    int entryCount() const { return m_entryCount; }
+    int keyBlockSize() const { return m_keyBlockSize; }
+    bool isMapped() const { return (m_data != nullptr) && m_image.isEmpty(); }
+    qint64 memoryUsage() const { return m_dataSize; }
+    qint64 keysMemoryUsage() const; // front-coded keys and block offsets, without entries
+
+    void build(const ZStardictIndexBuilder& builder, const ZStardictIndexFingerprint& fingerprint);
+    // Builders are sorted as runs in parallel and merged, equal keys keep builders order
+    void build(const QVector<ZStardictIndexBuilder>& builders, const ZStardictIndexFingerprint& fingerprint);
+    bool load(const QString& cacheFilename, const ZStardictIndexFingerprint& fingerprint);
+    bool save(const QString& cacheFilename) const;
+
+    int lowerBound(const QByteArray& key) const;
+    int upperBound(const QByteArray& key) const;
+    int prefixUpperBound(const QByteArray& prefix) const;
+    bool startsWith(int pos, const QByteArray& prefix) const;
+    bool equals(int pos, const QByteArray& key) const;
+    QString key(int pos) const;
+    // Keys within Levenshtein distance (in code points) from query, (distance, position) pairs in key order
+    QVector<QPair<int,int> > fuzzyMatches(const QVector<uint>& query, int maxDistance,
+                                          const std::function<bool()>& isCancelled) const;
+    quint32 entry(int pos) const { return m_entryIds[pos]; }
+    quint64 offset(int pos) const { return m_entryOffsets[m_entryIds[pos]]; }
+    quint32 size(int pos) const { return m_entrySizes[m_entryIds[pos]]; }
+
+private:
+    const char* blockHead(int block, quint32* length) const;
+
+    // First position where isBefore(key data, key length) is false
+    template<typename Predicate>
+    int partitionPoint(Predicate isBefore) const;
+
+};
+
+}
+
+#endif // ZSTARDICTINDEX_H
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <execution>
+#include <cstring>
+
+#include "zstardictsubstringindex.h"
+#include "zstardictindex.h"
+
+namespace {
+
+const int trigramLength = 3;
+const int cancelCheckInterval = 4096;
+
+inline quint32 trigramAt(const char* data)
+{
+    return (static_cast<quint32>(static_cast<uchar>(data[0])) << 16U) |
+            (static_cast<quint32>(static_cast<uchar>(data[1])) << 8U) |
+            static_cast<quint32>(static_cast<uchar>(data[2]));
+}
+
+bool containsBytes(const char* data, quint32 length, const QByteArray& substring)
+{
+    if (length < static_cast<quint32>(substring.size())) return false;
+    return (memmem(data,length,substring.constData(),static_cast<size_t>(substring.size())) != nullptr);
+}
+
+}
+
+namespace ZDict {
+
+qint64 ZStardictSubstringIndex::memoryUsage() const
+{
+    return static_cast<qint64>(m_trigrams.count() + m_listOffsets.count()) * static_cast<qint64>(sizeof(quint32)) +
+            static_cast<qint64>(m_postings.count()) * static_cast<qint64>(sizeof(qint32));
+}
+
+const qint32 *ZStardictSubstringIndex::postings(quint32 trigram, qint32 *count) const
+{
+    const auto it = std::lower_bound(m_trigrams.constBegin(),m_trigrams.constEnd(),trigram);
+    if ((it == m_trigrams.constEnd()) || (*it != trigram)) {
+        *count = 0;
+        return nullptr;
+    }
+
+    const auto idx = it - m_trigrams.constBegin();
+    *count = static_cast<qint32>(m_listOffsets.at(idx + 1) - m_listOffsets.at(idx));
+    return m_postings.constData() + m_listOffsets.at(idx);
+}
+
+bool ZStardictSubstringIndex::build(const ZStardictIndex &index, const std::function<bool()> &isCancelled)
+{
+    m_trigrams.clear();
+    m_listOffsets.clear();
+    m_postings.clear();
+
+    // (trigram << 32) | position, for the first position of each distinct key
+    QVector<quint64> pairs;
+    pairs.reserve(index.count() * 4);
+    QVector<quint32> keyTrigrams;
+    ZStardictKeyCursor cursor(&index);
+    quint32 prevLength = 0U;
+    for (bool valid = cursor.seek(0); valid; valid = cursor.next()) {
+        const int pos = cursor.pos();
+        if ((pos % cancelCheckInterval == 0) && isCancelled && isCancelled())
+            return false;
+        // equal to the previous key when it shares all of it
+        const bool duplicate = (pos > 0) && (cursor.shared() == prevLength) && (cursor.length() == prevLength);
+        prevLength = cursor.length();
+        if (duplicate)
+            continue;
+
+        const char* key = cursor.data();
+        const auto len = static_cast<int>(cursor.length());
+        keyTrigrams.clear();
+        for (int i = 0; i + trigramLength <= len; i++)
+            keyTrigrams.append(trigramAt(key + i));
+        std::sort(keyTrigrams.begin(),keyTrigrams.end());
+        const auto last = std::unique(keyTrigrams.begin(),keyTrigrams.end());
+        for (auto it = keyTrigrams.begin(); it != last; ++it)
+            pairs.append((static_cast<quint64>(*it) << 32U) | static_cast<quint32>(pos));
+    }
+
+    if (isCancelled && isCancelled())
+        return false;
+
+    std::sort(std::execution::par,pairs.begin(),pairs.end());
+
+    m_postings.resize(pairs.count());
+    for (qsizetype i = 0; i < pairs.count(); i++) {
+        const auto trigram = static_cast<quint32>(pairs.at(i) >> 32U);
+        if (m_trigrams.isEmpty() || (m_trigrams.constLast() != trigram)) {
+            m_trigrams.append(trigram);
+            m_listOffsets.append(static_cast<quint32>(i));
+        }
+        m_postings[i] = static_cast<qint32>(pairs.at(i) & 0xffffffffU);
+    }
+    m_listOffsets.append(static_cast<quint32>(pairs.count()));
+    m_trigrams.squeeze();
+    m_listOffsets.squeeze();
+
+    return true;
+}
+
+QVector<int> ZStardictSubstringIndex::lookup(const ZStardictIndex &index, const QByteArray &substring, int limit,
+                                             const std::function<bool()> &isCancelled) const
+{
+    QVector<int> res;
+    if (substring.isEmpty() || (limit <= 0)) return res;
+
+    // too short for trigrams or index is not built yet
+    if ((substring.size() < trigramLength) || isEmpty()) {
+        ZStardictKeyCursor cursor(&index);
+        quint32 prevLength = 0U;
+        for (bool valid = cursor.seek(0); valid && (res.count() < limit); valid = cursor.next()) {
+            const int pos = cursor.pos();
+            if ((pos % cancelCheckInterval == 0) && isCancelled && isCancelled())
+                break;
+            const bool duplicate = (pos > 0) && (cursor.shared() == prevLength) && (cursor.length() == prevLength);
+            prevLength = cursor.length();
+            if (duplicate)
+                continue;
+            if (containsBytes(cursor.data(),cursor.length(),substring))
+                res.append(pos);
+        }
+        return res;
+    }
+
+    QVector<QPair<const qint32*,qint32> > lists;
+    for (int i = 0; i + trigramLength <= substring.size(); i++) {
+        qint32 count = 0;
+        const qint32* list = postings(trigramAt(substring.constData() + i),&count);
+        if (list == nullptr) return res;
+        lists.append(qMakePair(list,count));
+    }
+
+    // intersect starting from the shortest list, candidate set only shrinks
+    std::sort(lists.begin(),lists.end(),[](const QPair<const qint32*,qint32>& a,
+                                           const QPair<const qint32*,qint32>& b){
+        return (a.second < b.second);
+    });
+
+    QVector<qint32> candidates(lists.constFirst().first,lists.constFirst().first + lists.constFirst().second);
+    QVector<qint32> intersection;
+    for (int i = 1; (i < lists.count()) && !candidates.isEmpty(); i++) {
+        if (isCancelled && isCancelled()) return res;
+        const auto &list = lists.at(i);
+        intersection.resize(candidates.count());
+        const auto last = std::set_intersection(candidates.constBegin(),candidates.constEnd(),
+                                                list.first,list.first + list.second,
+                                                intersection.begin());
+        intersection.resize(last - intersection.begin());
+        candidates.swap(intersection);
+    }
+
+    // candidates are sorted, the cursor mostly moves forward within a block
+    ZStardictKeyCursor cursor(&index);
+    for (const auto pos : std::as_const(candidates)) {
+        if (res.count() >= limit) break;
+        if (cursor.seek(pos) && containsBytes(cursor.data(),cursor.length(),substring))
+            res.append(pos);
+    }
+
+    return res;
+}
+
+}
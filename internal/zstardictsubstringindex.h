@@ -0,0 +1,39 @@
+#ifndef ZSTARDICTSUBSTRINGINDEX_H
+#define ZSTARDICTSUBSTRINGINDEX_H
+
+#include <functional>
+#include <QByteArray>
+#include <QVector>
+
+namespace ZDict {
+
+class ZStardictIndex;
+
+/* Byte trigram posting lists over distinct keys of ZStardictIndex.
+ * Posting lists hold key positions in key order. Candidates from the posting lists
+ * intersection are verified against the key, so results are exact. */
+class ZStardictSubstringIndex
+{
+private:
+    QVector<quint32> m_trigrams; // sorted trigram ids
+    QVector<quint32> m_listOffsets; // posting list bounds, m_trigrams.count()+1 items
+    QVector<qint32> m_postings;
+
+    const qint32* postings(quint32 trigram, qint32* count) const;
+
+public:
+    ZStardictSubstringIndex() = default;
+
+    bool isEmpty() const { return m_trigrams.isEmpty(); }
+    qint64 memoryUsage() const;
+
+    bool build(const ZStardictIndex& index, const std::function<bool()>& isCancelled);
+    // Positions of keys containing the substring in key order, up to limit items.
+    // Substrings shorter than a trigram are matched with a full scan.
+    QVector<int> lookup(const ZStardictIndex& index, const QByteArray& substring, int limit,
+                        const std::function<bool()>& isCancelled) const;
+};
+
+}
+
+#endif // ZSTARDICTSUBSTRINGINDEX_H
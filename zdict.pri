@@ -1,5 +1,3 @@
-QT += xml
-
 INCLUDEPATH += $$PWD
 DEPENDPATH += $$PWD
 
@@ -7,13 +5,22 @@ SOURCES += \
     $$PWD/internal/zdictconversions.cpp \
     $$PWD/zdictcontroller.cpp \
     $$PWD/internal/zdictcompress.cpp \
-    $$PWD/internal/zstardictdictionary.cpp
+    $$PWD/internal/zstardictdictionary.cpp \
+    $$PWD/internal/zstardictindex.cpp \
+    $$PWD/internal/zdicttokenizer.cpp \
+    $$PWD/internal/zstardictsubstringindex.cpp \
+    $$PWD/internal/zdictmetrics.cpp
 
 HEADERS += \
     $$PWD/internal/zdictconversions.h \
     $$PWD/zdictcontroller.h \
     $$PWD/internal/zdictcompress.h \
     $$PWD/internal/zdictionary.h \
-    $$PWD/internal/zstardictdictionary.h
+    $$PWD/internal/zdictlrucache.h \
+    $$PWD/internal/zstardictdictionary.h \
+    $$PWD/internal/zstardictindex.h \
+    $$PWD/internal/zdicttokenizer.h \
+    $$PWD/internal/zstardictsubstringindex.h \
+    $$PWD/internal/zdictmetrics.h
 
 LIBS += -lz -ltbb
@@ -7,28 +7,279 @@
 #include <QFileInfo>
 #include <QString>
 #include <QThread>
+#include <QHash>
+#include <QSet>
+#include <QDeadlineTimer>
+#include <QStandardPaths>
 #include <QCoreApplication>
 
 #include "zdictcontroller.h"
 #include "internal/zdictionary.h"
 #include "internal/zstardictdictionary.h"
+#include "internal/zdictcompress.h"
 
 #include <QDebug>
 
+namespace {
+
+/* Code point order, same as UTF-8 byte order used by dictionary indexes.
+ * Plain QString comparison sorts surrogate pairs before U+E000..U+FFFF. */
+bool codePointLess(const QString& a, const QString& b)
+{
+    const auto fixup = [](char16_t c) -> char16_t {
+        if (c < 0xD800U) return c;
+        return (c >= 0xE000U) ? static_cast<char16_t>(c - 0x800U) : static_cast<char16_t>(c + 0x2000U);
+    };
+
+    const int len = static_cast<int>(qMin(a.size(),b.size()));
+    for (int i = 0; i < len; i++) {
+        const char16_t ca = a.at(i).unicode();
+        const char16_t cb = b.at(i).unicode();
+        if (ca != cb)
+            return (fixup(ca) < fixup(cb));
+    }
+    return (a.size() < b.size());
+}
+
+QString normalizeLookupWord(const QString& word)
+{
+    static const QRegularExpression whitespacesRx(ZDQSL("\\s+.*"),QRegularExpression::UseUnicodePropertiesOption);
+    static const QRegularExpression nonLettersRx(ZDQSL("\\W+"),QRegularExpression::UseUnicodePropertiesOption);
+
+    QString w = word.toLower();
+
+    w.remove(whitespacesRx);
+    w.remove(nonLettersRx);
+    return w;
+}
+
+QString normalizeArticleWord(const QString& word)
+{
+    static const QRegularExpression rx(ZDQSL("\\s+\\[.*\\]"));
+
+    QString w = word.toLower();
+    w.remove(rx);
+    return w;
+}
+
+/* k-way merge of sorted per-dictionary lists, stops after limit unique words */
+QStringList mergeLookupResults(const QVector<const QStringList*>& lists, int limit)
+{
+    QStringList out;
+
+    QVector<QPair<const QStringList*,int> > heap;
+    heap.reserve(lists.count());
+    for (const auto *list : lists) {
+        if (!list->isEmpty())
+            heap.append(qMakePair(list,0));
+    }
+    const auto heapCompare = [](const QPair<const QStringList*,int>& a, const QPair<const QStringList*,int>& b){
+        return codePointLess(b.first->at(b.second),a.first->at(a.second));
+    };
+    std::make_heap(heap.begin(),heap.end(),heapCompare);
+
+    while (!heap.isEmpty() && (out.count() < limit)) {
+        std::pop_heap(heap.begin(),heap.end(),heapCompare);
+        auto &cursor = heap.last();
+        const QString &candidate = cursor.first->at(cursor.second);
+        if (out.isEmpty() || (out.constLast() != candidate))
+            out.append(candidate);
+
+        cursor.second++;
+        if (cursor.second < cursor.first->count()) {
+            std::push_heap(heap.begin(),heap.end(),heapCompare);
+        } else {
+            heap.removeLast();
+        }
+    }
+
+    return out;
+}
+
+}
+
 namespace ZDict {
 
 ZDictController::ZDictController(QObject *parent)
     : QObject(parent)
 {
+    m_indexCacheDirectory = QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
+                            .filePath(ZDQSL("zdict_index"));
+
+    // each request is parallelized over dictionaries internally, one worker per request kind
+    m_lookupPool.setObjectName(ZDQSL("ZDICT_lookup"));
+    m_lookupPool.setMaxThreadCount(1);
+    m_lookupPool.setExpiryTimeout(-1);
+    m_articlePool.setObjectName(ZDQSL("ZDICT_article"));
+    m_articlePool.setMaxThreadCount(1);
+    m_articlePool.setExpiryTimeout(-1);
+    m_loaderPool.setObjectName(ZDQSL("ZDICT_startup"));
+    m_loaderPool.setMaxThreadCount(1);
+    // substring indexes are optional, don't compete with lookups for all cores
+    m_indexerPool.setObjectName(ZDQSL("ZDICT_indexer"));
+    m_indexerPool.setMaxThreadCount(qMax(1,QThread::idealThreadCount() / 2));
+
+    // coalesce bursts of file system events into one reload
+    const int reloadDelayMS = 2000;
+    m_reloadTimer.setSingleShot(true);
+    m_reloadTimer.setInterval(reloadDelayMS);
+    connect(&m_reloadTimer,&QTimer::timeout,this,&ZDictController::reloadDictionaries);
+}
+
+ZDictController::~ZDictController()
+{
+    // supersede everything, so workers drop results instead of emitting from destroyed object
+    m_activeLookupId.storeRelease(0U);
+    m_activeArticleId.storeRelease(0U);
+    m_lookupPool.clear();
+    m_articlePool.clear();
+    cancelActiveWork();
+    m_lookupPool.waitForDone();
+    m_articlePool.waitForDone();
+    m_loaderPool.waitForDone();
+    m_substringIndexEnabled.storeRelease(false);
+    m_indexerPool.clear();
+    m_indexerPool.waitForDone();
+}
+
+void ZDictController::setIndexLoading(IndexLoading mode)
+{
+    m_indexLoading = mode;
+}
+
+bool ZDictController::activateDictionary(const QSharedPointer<ZDictionary> &dict)
+{
+    if (dict->isReady()) return true;
+
+    if (!dict->activate()) {
+        qWarning() << ZDQSL("Failed to load dictionary indexes: %1").arg(dict->getName());
+        // evicted dictionary changed on disk is replaced by a new object on reload,
+        // may be called from lookup threads, so the timer is started in its own thread
+        if (dict->isModified())
+            QMetaObject::invokeMethod(&m_reloadTimer,qOverload<>(&QTimer::start),Qt::QueuedConnection);
+        return false;
+    }
+
+    qInfo() << ZDQSL("Dictionary loaded: %1 (%2)")
+               .arg(dict->getName())
+               .arg(dict->getWordCount());
+    Q_EMIT dictionaryReady(dict->getName());
+    scheduleSubstringIndex(dict);
+    enforceMemoryBudget();
+    return true;
+}
+
+void ZDictController::scheduleSubstringIndex(const QSharedPointer<ZDictionary> &dict)
+{
+    if (!m_substringIndexEnabled.loadAcquire()) return;
+
+    m_indexerPool.start([this,dict]{
+        if (QCoreApplication::closingDown() || !m_substringIndexEnabled.loadAcquire()) return;
+        // evicted dictionary gets new substring index after reload
+        const ZDictionaryUsage usage(dict.data(),false);
+        if (!dict->isReady()) return;
+        if (!dict->buildSubstringIndex())
+            qWarning() << ZDQSL("Failed to build substring index: %1").arg(dict->getName());
+    });
+}
+
+void ZDictController::setSubstringIndex(bool enable)
+{
+    m_substringIndexEnabled.storeRelease(enable);
+    if (!enable) {
+        m_indexerPool.clear();
+        return;
+    }
+
+    const auto dicts = dictionaries();
+    for (const auto &dict : dicts) {
+        if (dict->isReady())
+            scheduleSubstringIndex(dict);
+    }
+}
+
+bool ZDictController::isDictionaryUsable(const QSharedPointer<ZDictionary> &dict)
+{
+    if (dict->isReady()) return true;
+    // evicted dictionaries are reloaded on demand in any loading mode
+    if ((m_indexLoading == IndexLoading::OnDemand) || (dict->evictions() > 0))
+        return activateDictionary(dict);
+    return false;
+}
+
+void ZDictController::setMemoryBudget(qint64 bytes)
+{
+    m_memoryBudget.storeRelaxed(qMax<qint64>(0,bytes));
+    enforceMemoryBudget();
+}
+
+void ZDictController::enforceMemoryBudget()
+{
+    const qint64 budget = m_memoryBudget.loadRelaxed();
+    if (budget <= 0) return;
+
+    // one eviction pass at a time, it only tries to lock dictionaries and never waits for queries
+    QMutexLocker locker(&m_memoryMutex);
+
+    const auto dicts = dictionaries();
+    QVector<QSharedPointer<ZDictionary> > loaded;
+    qint64 used = 0L;
+    for (const auto &dict : dicts) {
+        if (!dict->isReady()) continue;
+        used += dict->memoryUsage();
+        loaded.append(dict);
+    }
+    if (used <= budget) return;
+
+    std::sort(loaded.begin(),loaded.end(),[](const QSharedPointer<ZDictionary>& a,
+                                             const QSharedPointer<ZDictionary>& b){
+        return (a->lastUse() < b->lastUse());
+    });
+
+    for (const auto &dict : std::as_const(loaded)) {
+        if (used <= budget) break;
+        const qint64 size = dict->memoryUsage();
+        if (!dict->evict()) continue; // busy, it's in use anyway
+        used -= size;
+        qInfo() << ZDQSL("Dictionary indexes evicted: %1 (%2 bytes)").arg(dict->getName()).arg(size);
+    }
+
+    if (used > budget)
+        qWarning() << ZDQSL("Dictionary indexes exceed memory budget: %1 of %2 bytes").arg(used).arg(budget);
 }
 
-ZDictController::~ZDictController() = default;
+ZDictMemoryStatistics ZDictController::memoryStatistics() const
+{
+    ZDictMemoryStatistics res;
+    res.budget = m_memoryBudget.loadRelaxed();
+
+    const auto dicts = dictionaries();
+    res.dictionaries = static_cast<int>(dicts.count());
+    for (const auto &dict : dicts) {
+        res.evictions += static_cast<quint64>(dict->evictions());
+        res.reloads += static_cast<quint64>(qMax(0,dict->indexLoads() - 1));
+
+        const ZDictionaryUsage usage(dict.data(),false);
+        if (!dict->isReady()) continue;
+        res.used += dict->memoryUsage();
+        res.loadedDictionaries++;
+    }
+
+    return res;
+}
 
 void ZDictController::loadDictionaries(const QStringList &pathList)
 {
-    m_dicts.clear();
+    m_pathList = pathList;
+
+    if (!m_indexCacheDirectory.isEmpty())
+        QDir().mkpath(m_indexCacheDirectory);
+
+    if (m_watcher)
+        updateWatchedDirectories();
 
-    QThread* th = QThread::create([this,pathList]{
+    // Reloads are serialized, current dictionaries stay available until the new set is swapped in
+    m_loaderPool.start([this,pathList]{
 
         QStringList files;
 
@@ -38,155 +289,721 @@ void ZDictController::loadDictionaries(const QStringList &pathList)
                 files.append(it.next());
         }
 
+        // unchanged dictionaries are reused, new and modified ones are loaded
+        QHash<QString,QSharedPointer<ZDictionary> > current;
+        for (const auto &dict : dictionaries())
+            current.insert(dict->getInfoFile(),dict);
+
+        // eager mode loads indexes here, lazy modes read only IFO metadata at this stage
+        const bool activateNow = (m_indexLoading == IndexLoading::Eager);
+        QVector<QSharedPointer<ZDictionary> > dicts;
+        QMutex dictsMutex;
         QAtomicInteger<int> wordCount;
+        QAtomicInteger<int> reusedCount;
         std::for_each(std::execution::par,files.constBegin(),files.constEnd(),
-                      [this,&wordCount](const QString& filename){
+                      [this,&current,&dicts,&dictsMutex,&wordCount,&reusedCount,activateNow]
+                      (const QString& filename){
             if (QCoreApplication::closingDown()) return;
 
             QFileInfo fi(filename);
             if (!fi.exists()) return;
 
-            ZDictionary *d = nullptr;
+            QSharedPointer<ZDictionary> d;
 
             if (fi.suffix().compare(ZDQSL("ifo"),Qt::CaseInsensitive) == 0) {
-                // StarDict dictionary info file
-                auto *dict = new ZStardictDictionary();
-                if (!dict->loadIndexes(fi.filePath())) {
-                    qWarning() << ZDQSL("Failed to load StarDict index file %1").arg(fi.filePath());
-                    delete dict;
-                    return;
+                const auto existing = current.value(fi.filePath());
+                if (existing && !existing->isModified()) {
+                    d = existing;
+                    reusedCount.fetchAndAddRelaxed(1);
+                } else {
+                    // replaced in place, compiled index of old files is never valid again
+                    if (existing)
+                        existing->removeIndexCache();
+
+                    // StarDict dictionary info file
+                    auto *dict = new ZStardictDictionary();
+                    dict->setIndexCacheDirectory(m_indexCacheDirectory);
+                    if (!dict->loadInfo(fi.filePath()) || (activateNow && !dict->activate())) {
+                        qWarning() << ZDQSL("Failed to load StarDict index file %1").arg(fi.filePath());
+                        delete dict;
+                        return;
+                    }
+                    d.reset(dict);
+
+                    if (activateNow) {
+                        qInfo() << ZDQSL("Dictionary loaded: %1 (%2)")
+                                   .arg(d->getName())
+                                   .arg(d->getWordCount());
+                        Q_EMIT dictionaryReady(d->getName());
+                    }
                 }
-                d = dict;
             }
 
             if (d) {
                 if (QCoreApplication::closingDown()) return;
 
-                m_dictsMutex.lock();
-                m_dicts.append(QSharedPointer<ZDictionary>(d));
-                m_dictsMutex.unlock();
+                dictsMutex.lock();
+                dicts.append(d);
+                dictsMutex.unlock();
 
-                int wc = d->getWordCount();
-                wordCount.fetchAndAddRelease(wc);
-                qInfo() << ZDQSL("Dictionary loaded: %1 (%2)")
-                           .arg(d->getName())
-                           .arg(wc);
+                wordCount.fetchAndAddRelease(d->getWordCount());
             }
         });
 
-        int dictsCount = m_dicts.count();
-        qInfo() << ZDQSL("Dictionaries loading complete, %1 dictionaries loaded.").arg(dictsCount);
+        // keep stable dictionary order between reloads
+        std::sort(dicts.begin(),dicts.end(),[](const QSharedPointer<ZDictionary>& a,
+                                               const QSharedPointer<ZDictionary>& b){
+            return (a->getInfoFile() < b->getInfoFile());
+        });
+
+        {
+            QMutexLocker locker(&m_dictsMutex);
+            m_dicts = dicts;
+        }
+
+        // removed dictionaries, replaced ones have their cache dropped above
+        for (const auto &dict : std::as_const(dicts))
+            current.remove(dict->getInfoFile());
+        for (const auto &dict : std::as_const(current)) {
+            if (!QFileInfo::exists(dict->getInfoFile()))
+                dict->removeIndexCache();
+        }
+
+        // watcher lives in controller thread, dictionary files are known only after loading
+        QMetaObject::invokeMethod(this,[this]{
+            if (m_watcher)
+                updateWatchedDirectories();
+        },Qt::QueuedConnection);
+
+        int dictsCount = dicts.count();
+        qInfo() << ZDQSL("Dictionaries loading complete, %1 dictionaries loaded (%2 unchanged).")
+                   .arg(dictsCount).arg(reusedCount.loadAcquire());
+        m_loaded.storeRelease(true);
         Q_EMIT dictionariesLoaded(ZDQSL("Loaded %1 dictionaries (%2 words).")
                                   .arg(dictsCount).arg(wordCount.loadAcquire()));
-        m_loaded.storeRelease(true);
+
+        enforceMemoryBudget();
+
+        // eagerly loaded dictionaries, reused ones already have substring index
+        for (const auto &dict : std::as_const(dicts)) {
+            if (dict->isReady())
+                scheduleSubstringIndex(dict);
+        }
+
+        if (m_indexLoading == IndexLoading::Background) {
+            std::for_each(std::execution::par,dicts.constBegin(),dicts.constEnd(),
+                          [this](const QSharedPointer<ZDictionary> & dict){
+                if (QCoreApplication::closingDown()) return;
+                activateDictionary(dict);
+            });
+        }
     });
+}
+
+void ZDictController::reloadDictionaries()
+{
+    loadDictionaries(m_pathList);
+}
+
+void ZDictController::setWatchDirectories(bool enable)
+{
+    if (!enable) {
+        delete m_watcher;
+        m_watcher = nullptr;
+        return;
+    }
+
+    if (m_watcher) return;
+
+    m_watcher = new QFileSystemWatcher(this);
+    connect(m_watcher,&QFileSystemWatcher::directoryChanged,&m_reloadTimer,qOverload<>(&QTimer::start));
+    // files overwritten in place don't change their directory
+    connect(m_watcher,&QFileSystemWatcher::fileChanged,&m_reloadTimer,qOverload<>(&QTimer::start));
+    updateWatchedDirectories();
+}
 
-    connect(th,&QThread::finished,th,&QThread::deleteLater);
-    th->setObjectName(ZDQSL("ZDICT_startup"));
-    th->start();
+void ZDictController::updateWatchedDirectories()
+{
+    const QStringList watched = m_watcher->directories() + m_watcher->files();
+    if (!watched.isEmpty())
+        m_watcher->removePaths(watched);
+
+    QStringList dirs;
+    for (const auto &path : std::as_const(m_pathList)) {
+        dirs.append(path);
+        QDirIterator it(path,QDir::Dirs | QDir::NoDotAndDotDot | QDir::Readable,QDirIterator::Subdirectories);
+        while (it.hasNext())
+            dirs.append(it.next());
+    }
+    if (!dirs.isEmpty())
+        m_watcher->addPaths(dirs);
+
+    QStringList files;
+    for (const auto &dict : dictionaries())
+        files.append(dict->getFiles());
+    if (!files.isEmpty())
+        m_watcher->addPaths(files);
+}
+
+QVector<QSharedPointer<ZDictionary> > ZDictController::dictionaries() const
+{
+    QMutexLocker locker(&m_dictsMutex);
+    return m_dicts;
 }
 
 QStringList ZDictController::wordLookup(const QString &word,
                                         bool suppressMultiforms,
                                         int maxLookupWords)
 {
-    static const QRegularExpression whitespacesRx(ZDQSL("\\s+.*"),QRegularExpression::UseUnicodePropertiesOption);
-    static const QRegularExpression nonLettersRx(ZDQSL("\\W+"),QRegularExpression::UseUnicodePropertiesOption);
-    QStringList res;
-    if (!m_loaded.loadAcquire()) return res;
-    if (word.isEmpty()) return res;
+    return wordLookupPage(word,QString(),suppressMultiforms,maxLookupWords);
+}
 
-    QString w = word.toLower();
+QStringList ZDictController::wordLookupPage(const QString &word,
+                                            const QString &startAfter,
+                                            bool suppressMultiforms,
+                                            int pageSize)
+{
+    return wordLookupPrivate(word,startAfter,suppressMultiforms,pageSize,nullptr);
+}
 
-    w.remove(whitespacesRx);
-    w.remove(nonLettersRx);
+QStringList ZDictController::wordLookupPrivate(const QString &word,
+                                               const QString &startAfter,
+                                               bool suppressMultiforms,
+                                               int pageSize,
+                                               const std::function<bool()> &isCancelled)
+{
+    const ZDictLatencyTimer latency(ZDictMetrics::Latency::WordLookup);
 
-    // Multithreaded word search - one thread per dictionary
-    QMutex resMutex;
-    std::for_each(std::execution::par,m_dicts.constBegin(),m_dicts.constEnd(),
-                  [&res,&resMutex,w,maxLookupWords,suppressMultiforms](const QSharedPointer<ZDictionary> & ptr){
+    QStringList out;
+    if (!m_loaded.loadAcquire()) return out;
+    if (word.isEmpty()) return out;
+
+    const QString w = normalizeLookupWord(word);
+
+    // Multithreaded word search - one thread per dictionary, each writes to its own slot
+    const auto dicts = dictionaries();
+    const auto *dictsBegin = dicts.constData();
+    QVector<QStringList> results(dicts.count());
+    std::for_each(std::execution::par,dicts.constBegin(),dicts.constEnd(),
+                  [this,&results,dictsBegin,&w,&startAfter,pageSize,suppressMultiforms,&isCancelled]
+                  (const QSharedPointer<ZDictionary> & ptr){
+        if (isCancelled && isCancelled()) return;
+        const ZDictionaryUsage usage(ptr.data());
+        if (!isDictionaryUsable(ptr)) return;
         ptr->resetStopRequest();
-        const QStringList sl = ptr->wordLookup(w,suppressMultiforms,maxLookupWords);
-        resMutex.lock();
-        res.append(sl);
-        resMutex.unlock();
+        results[&ptr - dictsBegin] = ptr->wordLookup(w,suppressMultiforms,pageSize,startAfter);
     });
 
-    // parallel sort and duplicates removing
-    std::sort(std::execution::par,res.begin(),res.end());
-    res.erase(std::unique(std::execution::par,res.begin(),res.end()),res.end());
+    if (isCancelled && isCancelled()) return out;
+
+    QVector<const QStringList*> lists;
+    lists.reserve(results.count());
+    for (const auto &list : std::as_const(results))
+        lists.append(&list);
+
+    return mergeLookupResults(lists,pageSize);
+}
+
+QStringList ZDictController::fuzzyLookup(const QString &word,
+                                         int maxDistance,
+                                         int maxLookupWords,
+                                         int timeBudgetMS)
+{
+    return fuzzyLookupPrivate(word,maxDistance,maxLookupWords,timeBudgetMS,nullptr);
+}
+
+QStringList ZDictController::fuzzyLookupPrivate(const QString &word,
+                                                int maxDistance,
+                                                int maxLookupWords,
+                                                int timeBudgetMS,
+                                                const std::function<bool ()> &isCancelled)
+{
+    const ZDictLatencyTimer latency(ZDictMetrics::Latency::FuzzyLookup);
 
-    // parallel cutting first n words for result
     QStringList out;
-    int nelems = qMin(maxLookupWords,res.count());
-    out.reserve(nelems);
-    std::copy_n(std::execution::par,res.begin(),nelems,std::back_inserter(out));
+    if (!m_loaded.loadAcquire()) return out;
+
+    const QString w = normalizeLookupWord(word);
+    if (w.isEmpty()) return out;
+
+    // one budget for all dictionaries, they are scanned in parallel
+    const QDeadlineTimer deadline(timeBudgetMS);
+    const auto dicts = dictionaries();
+    const auto *dictsBegin = dicts.constData();
+    QVector<QVector<QPair<QString,int> > > results(dicts.count());
+    std::for_each(std::execution::par,dicts.constBegin(),dicts.constEnd(),
+                  [this,&results,dictsBegin,&w,&deadline,maxDistance,maxLookupWords,&isCancelled]
+                  (const QSharedPointer<ZDictionary> & ptr){
+        if (isCancelled && isCancelled()) return;
+        const ZDictionaryUsage usage(ptr.data());
+        if (!isDictionaryUsable(ptr)) return;
+        ptr->resetStopRequest();
+        results[&ptr - dictsBegin] = ptr->fuzzyLookup(w,maxDistance,maxLookupWords,deadline,isCancelled);
+    });
+
+    if (isCancelled && isCancelled()) return out;
+
+    QVector<QPair<QString,int> > matches;
+    for (const auto &list : std::as_const(results))
+        matches.append(list);
+    std::sort(matches.begin(),matches.end(),[](const QPair<QString,int>& a, const QPair<QString,int>& b){
+        if (a.second != b.second)
+            return (a.second < b.second);
+        return codePointLess(a.first,b.first);
+    });
+
+    QSet<QString> used;
+    for (const auto &match : std::as_const(matches)) {
+        if (out.count() >= maxLookupWords) break;
+        if (used.contains(match.first)) continue;
+        used.insert(match.first);
+        out.append(match.first);
+    }
+
     return out;
 }
 
-void ZDictController::wordLookupAsync(const QString &word, bool suppressMultiforms, int maxLookupWords)
+QStringList ZDictController::substringLookup(const QString &word, int maxLookupWords)
 {
-    QThread *th = QThread::create([this,word,suppressMultiforms,maxLookupWords]{
-        QStringList res = wordLookup(word,suppressMultiforms,maxLookupWords);
-        Q_EMIT wordListComplete(res);
+    return substringLookupPrivate(word,maxLookupWords,nullptr);
+}
+
+QStringList ZDictController::substringLookupPrivate(const QString &word,
+                                                    int maxLookupWords,
+                                                    const std::function<bool ()> &isCancelled)
+{
+    const ZDictLatencyTimer latency(ZDictMetrics::Latency::SubstringLookup);
+
+    QStringList out;
+    if (!m_loaded.loadAcquire()) return out;
+
+    const QString w = normalizeLookupWord(word);
+    if (w.isEmpty()) return out;
+
+    const auto dicts = dictionaries();
+    const auto *dictsBegin = dicts.constData();
+    QVector<QStringList> results(dicts.count());
+    std::for_each(std::execution::par,dicts.constBegin(),dicts.constEnd(),
+                  [this,&results,dictsBegin,&w,maxLookupWords,&isCancelled]
+                  (const QSharedPointer<ZDictionary> & ptr){
+        if (isCancelled && isCancelled()) return;
+        const ZDictionaryUsage usage(ptr.data());
+        if (!isDictionaryUsable(ptr)) return;
+        ptr->resetStopRequest();
+        results[&ptr - dictsBegin] = ptr->substringLookup(w,maxLookupWords,isCancelled);
     });
-    connect(th,&QThread::finished,th,&QThread::deleteLater);
-    th->setObjectName(ZDQSL("ZDICT_lookup"));
-    th->start();
+
+    if (isCancelled && isCancelled()) return out;
+
+    QVector<const QStringList*> lists;
+    lists.reserve(results.count());
+    for (const auto &list : std::as_const(results))
+        lists.append(&list);
+
+    return mergeLookupResults(lists,maxLookupWords);
 }
 
-QString ZDictController::loadArticle(const QString &word, bool addDictionaryName)
+QVector<QStringList> ZDictController::wordLookupBatch(const QStringList &words,
+                                                      bool suppressMultiforms,
+                                                      int maxLookupWords)
 {
-    static const QRegularExpression rx(ZDQSL("\\s+\\[.*\\]"));
+    QVector<QStringList> out(words.count());
+    if (!m_loaded.loadAcquire()) return out;
+
+    QStringList normalized;
+    normalized.reserve(words.count());
+    for (const auto &word : words)
+        normalized.append(normalizeLookupWord(word));
+
+    // one thread per dictionary, each dictionary handles the whole batch
+    const auto dicts = dictionaries();
+    const auto *dictsBegin = dicts.constData();
+    QVector<QVector<QStringList> > results(dicts.count());
+    std::for_each(std::execution::par,dicts.constBegin(),dicts.constEnd(),
+                  [this,&results,dictsBegin,&normalized,maxLookupWords,suppressMultiforms]
+                  (const QSharedPointer<ZDictionary> & ptr){
+        QVector<QStringList> &dictResults = results[&ptr - dictsBegin];
+        dictResults.resize(normalized.count());
+        const ZDictionaryUsage usage(ptr.data());
+        if (!isDictionaryUsable(ptr)) return;
+
+        ptr->resetStopRequest();
+        for (int i = 0; i < normalized.count(); i++) {
+            if (!normalized.at(i).isEmpty())
+                dictResults[i] = ptr->wordLookup(normalized.at(i),suppressMultiforms,maxLookupWords);
+        }
+    });
+
+    QVector<const QStringList*> lists(results.count());
+    for (int i = 0; i < words.count(); i++) {
+        for (int d = 0; d < results.count(); d++)
+            lists[d] = &(results.at(d).at(i));
+        out[i] = mergeLookupResults(lists,maxLookupWords);
+    }
+
+    return out;
+}
+
+void ZDictController::setIndexCacheDirectory(const QString &path)
+{
+    m_indexCacheDirectory = path;
+}
+
+void ZDictController::setChunkCacheSize(qint64 bytes)
+{
+    dictZipChunkCache().setMaxCost(bytes);
+}
+
+ZDictCacheStatistics ZDictController::chunkCacheStatistics()
+{
+    return dictZipChunkCache().statistics();
+}
+
+void ZDictController::setMetricsEnabled(bool enable)
+{
+    metrics().setEnabled(enable);
+}
+
+void ZDictController::resetMetrics()
+{
+    metrics().reset();
+}
+
+ZDictMetricsSnapshot ZDictController::metricsSnapshot() const
+{
+    ZDictMetricsSnapshot res;
+    metrics().fillSnapshot(&res);
+    res.chunkCache = chunkCacheStatistics();
+    res.articleCache = articleCacheStatistics();
+
+    const auto dicts = dictionaries();
+    res.dictionaries.reserve(dicts.count());
+    for (const auto &dict : dicts) {
+        const ZDictionaryUsage usage(dict.data(),false);
+        res.dictionaries.append(dict->getMetrics());
+    }
+    res.memory = memoryStatistics();
+
+    return res;
+}
+
+void ZDictController::setArticleCacheSize(qint64 bytes)
+{
+    articleCache().setMaxCost(bytes);
+    articleUtf8Cache().setMaxCost(bytes);
+}
+
+ZDictCacheStatistics ZDictController::articleCacheStatistics()
+{
+    ZDictCacheStatistics res = articleCache().statistics();
+    const ZDictCacheStatistics utf8 = articleUtf8Cache().statistics();
+    res.hits += utf8.hits;
+    res.misses += utf8.misses;
+    res.totalCost += utf8.totalCost;
+    res.maxCost += utf8.maxCost;
+    return res;
+}
+
+quint64 ZDictController::startAsyncRequest(QThreadPool *pool, QAtomicInteger<quint64> *activeId,
+                                           const AsyncRequest &request)
+{
+    const quint64 requestId = m_lastRequestId.fetchAndAddRelaxed(1U) + 1U;
+    const quint64 previousId = activeId->fetchAndStoreRelease(requestId);
+    if ((previousId != 0U) && metrics().isEnabled())
+        metrics().addSupersededRequest();
+
+    // latest wins: queued requests are dropped, running request sees cancellation inside dictionary scans
+    pool->clear();
+    pool->start([requestId,activeId,request]{
+        const std::function<bool()> isCancelled = [activeId,requestId]{
+            return (activeId->loadAcquire() != requestId);
+        };
+        if (isCancelled()) return;
+
+        request(requestId,isCancelled);
+        activeId->testAndSetRelease(requestId,0U); // completed, next request doesn't supersede it
+    });
+
+    return requestId;
+}
+
+quint64 ZDictController::wordLookupAsync(const QString &word, bool suppressMultiforms, int maxLookupWords)
+{
+    return startAsyncRequest(&m_lookupPool,&m_activeLookupId,
+                             [this,word,suppressMultiforms,maxLookupWords]
+                             (quint64 requestId, const std::function<bool()>& isCancelled){
+        const QStringList res = wordLookupPrivate(word,QString(),suppressMultiforms,maxLookupWords,isCancelled);
+        if (!isCancelled())
+            Q_EMIT wordListComplete(res,requestId);
+    });
+}
+
+quint64 ZDictController::fuzzyLookupAsync(const QString &word, int maxDistance, int maxLookupWords, int timeBudgetMS)
+{
+    // shares executor with word lookups, the latest lookup of any kind wins
+    return startAsyncRequest(&m_lookupPool,&m_activeLookupId,
+                             [this,word,maxDistance,maxLookupWords,timeBudgetMS]
+                             (quint64 requestId, const std::function<bool()>& isCancelled){
+        const QStringList res = fuzzyLookupPrivate(word,maxDistance,maxLookupWords,timeBudgetMS,isCancelled);
+        if (!isCancelled())
+            Q_EMIT wordListComplete(res,requestId);
+    });
+}
+
+quint64 ZDictController::substringLookupAsync(const QString &word, int maxLookupWords)
+{
+    return startAsyncRequest(&m_lookupPool,&m_activeLookupId,
+                             [this,word,maxLookupWords]
+                             (quint64 requestId, const std::function<bool()>& isCancelled){
+        const QStringList res = substringLookupPrivate(word,maxLookupWords,isCancelled);
+        if (!isCancelled())
+            Q_EMIT wordListComplete(res,requestId);
+    });
+}
+
+QString ZDictController::loadArticle(const QString &word, bool addDictionaryName, bool emitSections)
+{
+    return loadArticlePrivate(word,addDictionaryName,emitSections,0U,nullptr);
+}
+
+QString ZDictController::loadArticlePrivate(const QString &word,
+                                            bool addDictionaryName,
+                                            bool emitSections,
+                                            quint64 requestId,
+                                            const std::function<bool()> &isCancelled)
+{
+    const ZDictLatencyTimer latency(ZDictMetrics::Latency::Article);
+    const QString hr = ZDQSL("<hr/>");
 
     QString res;
     if (!m_loaded.loadAcquire()) return res;
 
-    QString w = word.toLower();
-    w.remove(rx);
+    const QString w = normalizeArticleWord(word);
+
+    // Multithreaded article loading - one thread per dictionary, sections keep dictionary order
+    const auto dicts = dictionaries();
+    const auto *dictsBegin = dicts.constData();
+    QVector<QString> sections(dicts.count());
+    QVector<bool> ready(dicts.count(),false);
+    QMutex sectionsMutex;
+    int nextSection = 0;
+    bool sectionEmitted = false;
+    std::for_each(std::execution::par,dicts.constBegin(),dicts.constEnd(),
+                  [this,&sections,&ready,&sectionsMutex,&nextSection,&sectionEmitted,
+                  dictsBegin,&w,&hr,addDictionaryName,emitSections,requestId,&isCancelled]
+                  (const QSharedPointer<ZDictionary> & dict){
+        const auto idx = &dict - dictsBegin;
+        QString section;
+        if (!isCancelled || !isCancelled()) {
+            const ZDictionaryUsage usage(dict.data());
+            if (isDictionaryUsable(dict)) {
+                dict->resetStopRequest();
+                section = dict->loadArticle(w);
+            }
+        }
+        if (!section.isEmpty() && addDictionaryName)
+            section.prepend(ZDQSL("<h4>%1:</h4>").arg(dict->getName()));
+
+        QMutexLocker locker(&sectionsMutex);
+        sections[idx] = section;
+        ready[idx] = true;
+
+        if (emitSections && (!isCancelled || !isCancelled())) {
+            // emit every finished section that has all preceding sections ready
+            while ((nextSection < ready.count()) && ready.at(nextSection)) {
+                const QString &s = sections.at(nextSection);
+                if (!s.isEmpty()) {
+                    Q_EMIT articleSectionReady(sectionEmitted ? hr + s : s,requestId);
+                    sectionEmitted = true;
+                }
+                nextSection++;
+            }
+        }
+    });
+
+    for (const auto &section : std::as_const(sections)) {
+        if (section.isEmpty()) continue;
+
+        if (!res.isEmpty())
+            res.append(hr);
+        res.append(section);
+    }
+    return res;
+}
+
+QByteArray ZDictController::loadArticleUtf8(const QString &word, bool addDictionaryName)
+{
+    const ZDictLatencyTimer latency(ZDictMetrics::Latency::Article);
+    const QByteArray hr("<hr/>");
 
-    for (const auto& dict : std::as_const(m_dicts)) {
+    QByteArray res;
+    if (!m_loaded.loadAcquire()) return res;
+
+    const QString w = normalizeArticleWord(word);
+
+    const auto dicts = dictionaries();
+    const auto *dictsBegin = dicts.constData();
+    QVector<QByteArray> sections(dicts.count());
+    std::for_each(std::execution::par,dicts.constBegin(),dicts.constEnd(),
+                  [this,&sections,dictsBegin,&w](const QSharedPointer<ZDictionary> & dict){
+        const ZDictionaryUsage usage(dict.data());
+        if (!isDictionaryUsable(dict)) return;
         dict->resetStopRequest();
-        const QString article = dict->loadArticle(w);
-        if (!article.isEmpty()) {
-            QString hr;
-            if (!res.isEmpty())
-                hr = ZDQSL("<hr/>");
+        sections[&dict - dictsBegin] = dict->loadArticleUtf8(w);
+    });
 
+    // presized output, sections are appended without intermediate strings
+    QVector<QByteArray> names(dicts.count());
+    qsizetype length = 0;
+    for (int i = 0; i < sections.count(); i++) {
+        if (sections.at(i).isEmpty()) continue;
+        if (addDictionaryName)
+            names[i] = ZDQSL("<h4>%1:</h4>").arg(dicts.at(i)->getName()).toUtf8();
+        length += sections.at(i).size() + names.at(i).size() + hr.size();
+    }
+    res.reserve(length);
+
+    for (int i = 0; i < sections.count(); i++) {
+        if (sections.at(i).isEmpty()) continue;
+
+        if (!res.isEmpty())
             res.append(hr);
+        res.append(names.at(i));
+        res.append(sections.at(i));
+    }
+    return res;
+}
+
+QVector<ZDictRawArticle> ZDictController::loadRawArticles(const QString &word)
+{
+    QVector<ZDictRawArticle> res;
+    if (!m_loaded.loadAcquire()) return res;
+
+    const QString w = normalizeArticleWord(word);
+
+    const auto dicts = dictionaries();
+    const auto *dictsBegin = dicts.constData();
+    QVector<QVector<ZDictRawArticle> > results(dicts.count());
+    std::for_each(std::execution::par,dicts.constBegin(),dicts.constEnd(),
+                  [this,&results,dictsBegin,&w](const QSharedPointer<ZDictionary> & dict){
+        const ZDictionaryUsage usage(dict.data());
+        if (!isDictionaryUsable(dict)) return;
+        dict->resetStopRequest();
+        auto &articles = results[&dict - dictsBegin];
+        articles = dict->loadRawArticles(w);
+        // article data may reference dictionary file mapping, keep dictionary alive with articles
+        for (auto &article : articles)
+            article.dictionary = dict;
+    });
+
+    for (const auto &articles : std::as_const(results))
+        res.append(articles);
+
+    return res;
+}
+
+QString ZDictController::renderRawArticle(const ZDictRawArticle &article)
+{
+    if (article.dictionary.isNull()) return QString();
+    return article.dictionary->renderRawArticle(article);
+}
+
+QByteArray ZDictController::renderRawArticleUtf8(const ZDictRawArticle &article)
+{
+    if (article.dictionary.isNull()) return QByteArray();
+    return article.dictionary->renderRawArticleUtf8(article);
+}
+
+QStringList ZDictController::loadArticleBatch(const QStringList &words, bool addDictionaryName)
+{
+    const QString hr = ZDQSL("<hr/>");
+
+    QStringList out;
+    out.reserve(words.count());
+    for (int i = 0; i < words.count(); i++)
+        out.append(QString());
+    if (!m_loaded.loadAcquire()) return out;
+
+    QStringList normalized;
+    normalized.reserve(words.count());
+    for (const auto &word : words)
+        normalized.append(normalizeArticleWord(word));
+
+    // one thread per dictionary, each dictionary reads the whole batch in file order
+    const auto dicts = dictionaries();
+    const auto *dictsBegin = dicts.constData();
+    QVector<QStringList> results(dicts.count());
+    std::for_each(std::execution::par,dicts.constBegin(),dicts.constEnd(),
+                  [this,&results,dictsBegin,&normalized]
+                  (const QSharedPointer<ZDictionary> & dict){
+        const ZDictionaryUsage usage(dict.data());
+        if (!isDictionaryUsable(dict)) return;
+        dict->resetStopRequest();
+        results[&dict - dictsBegin] = dict->loadArticles(normalized);
+    });
+
+    for (int d = 0; d < results.count(); d++) {
+        const auto &dictResults = results.at(d);
+        for (int i = 0; i < dictResults.count(); i++) {
+            const QString &article = dictResults.at(i);
+            if (article.isEmpty()) continue;
+
+            QString &res = out[i];
+            if (!res.isEmpty())
+                res.append(hr);
             if (addDictionaryName)
-                res.append(ZDQSL("<h4>%1:</h4>").arg(dict->getName()));
+                res.append(ZDQSL("<h4>%1:</h4>").arg(dicts.at(d)->getName()));
             res.append(article);
         }
     }
-    return res;
+
+    return out;
 }
 
-void ZDictController::loadArticleAsync(const QString &word, bool addDictionaryName)
+quint64 ZDictController::loadArticleAsync(const QString &word, bool addDictionaryName, bool emitSections)
 {
-    QThread *th = QThread::create([this,word,addDictionaryName]{
-        QString res = loadArticle(word,addDictionaryName);
-        Q_EMIT articleComplete(res);
+    return startAsyncRequest(&m_articlePool,&m_activeArticleId,
+                             [this,word,addDictionaryName,emitSections]
+                             (quint64 requestId, const std::function<bool()>& isCancelled){
+        const QString res = loadArticlePrivate(word,addDictionaryName,emitSections,requestId,isCancelled);
+        if (!isCancelled())
+            Q_EMIT articleComplete(res,requestId);
     });
-    connect(th,&QThread::finished,th,&QThread::deleteLater);
-    th->setObjectName(ZDQSL("ZDICT_article"));
-    th->start();
 }
 
 void ZDictController::cancelActiveWork()
 {
-    for (const auto &dict : std::as_const(m_dicts)) {
+    if (metrics().isEnabled())
+        metrics().addCancelRequest();
+
+    const auto dicts = dictionaries();
+    for (const auto &dict : dicts) {
         dict->stopRequest();
     }
 }
 
+QStringList ZDictController::getReadyDictionaries() const
+{
+    QStringList res;
+    if (!m_loaded.loadAcquire()) return res;
+
+    const auto dicts = dictionaries();
+    for (const auto & dict : dicts) {
+        if (dict->isReady())
+            res.append(dict->getName());
+    }
+
+    return res;
+}
+
 QStringList ZDictController::getLoadedDictionaries() const
 {
     QStringList res;
     if (!m_loaded.loadAcquire()) return res;
 
-    res.reserve(m_dicts.count());
-    for (const auto & dict : std::as_const(m_dicts))
+    const auto dicts = dictionaries();
+    res.reserve(dicts.count());
+    for (const auto & dict : dicts)
         res.append(ZDQSL("%1 (%2)").arg(dict->getName()).arg(dict->getWordCount()));
 
     return res;
@@ -1,12 +1,18 @@
 #ifndef ZDICTCONTROLLER_H
 #define ZDICTCONTROLLER_H
 
+#include <functional>
 #include <QObject>
 #include <QMap>
 #include <QPointer>
 #include <QMutex>
+#include <QThreadPool>
+#include <QTimer>
+#include <QFileSystemWatcher>
 
 #include "internal/zdictionary.h"
+#include "internal/zdictlrucache.h"
+#include "internal/zdictmetrics.h"
 
 namespace ZDict {
 
@@ -14,36 +20,155 @@ class ZDictController : public QObject
 {
     Q_OBJECT
     Q_DISABLE_COPY(ZDictController)
+public:
+    enum class IndexLoading {
+        Eager,      // load all indexes before dictionariesLoaded
+        Background, // read metadata, then load indexes in background, lookups use ready dictionaries
+        OnDemand    // read metadata, load index on first query to the dictionary
+    };
+    Q_ENUM(IndexLoading)
+
 private:
     QVector<QSharedPointer<ZDictionary> > m_dicts;
-    QMutex m_dictsMutex;
+    mutable QMutex m_dictsMutex;
     QAtomicInteger<bool> m_loaded;
+    QStringList m_pathList;
+    QString m_indexCacheDirectory;
+    IndexLoading m_indexLoading { IndexLoading::Eager };
+
+    // Async requests executors, one running and at most one queued request of each kind
+    QThreadPool m_lookupPool;
+    QThreadPool m_articlePool;
+    QAtomicInteger<quint64> m_lastRequestId;
+    QAtomicInteger<quint64> m_activeLookupId;
+    QAtomicInteger<quint64> m_activeArticleId;
+
+    // Dictionaries (re)loading, one reload at a time
+    QThreadPool m_loaderPool;
+    QPointer<QFileSystemWatcher> m_watcher;
+    QTimer m_reloadTimer;
+
+    // Optional substring indexes, built in background after dictionary indexes are loaded
+    QThreadPool m_indexerPool;
+    QAtomicInteger<bool> m_substringIndexEnabled;
+
+    // Memory budget for loaded indexes, least recently used dictionaries are evicted and reloaded on demand
+    QAtomicInteger<qint64> m_memoryBudget;
+    QMutex m_memoryMutex;
+
+    // request runs on the pool, cancelled when a newer request is started on the same pool
+    using AsyncRequest = std::function<void(quint64 requestId, const std::function<bool()>& isCancelled)>;
+    quint64 startAsyncRequest(QThreadPool* pool, QAtomicInteger<quint64>* activeId, const AsyncRequest& request);
+
+    QStringList wordLookupPrivate(const QString& word,
+                                  const QString& startAfter,
+                                  bool suppressMultiforms,
+                                  int pageSize,
+                                  const std::function<bool()>& isCancelled);
+    QStringList fuzzyLookupPrivate(const QString& word,
+                                   int maxDistance,
+                                   int maxLookupWords,
+                                   int timeBudgetMS,
+                                   const std::function<bool()>& isCancelled);
+    QStringList substringLookupPrivate(const QString& word,
+                                       int maxLookupWords,
+                                       const std::function<bool()>& isCancelled);
+    QString loadArticlePrivate(const QString& word,
+                               bool addDictionaryName,
+                               bool emitSections,
+                               quint64 requestId,
+                               const std::function<bool()>& isCancelled);
+    bool activateDictionary(const QSharedPointer<ZDictionary>& dict);
+    bool isDictionaryUsable(const QSharedPointer<ZDictionary>& dict);
+    void scheduleSubstringIndex(const QSharedPointer<ZDictionary>& dict);
+    void enforceMemoryBudget();
+    QVector<QSharedPointer<ZDictionary> > dictionaries() const; // snapshot, stays valid during reload
+    void updateWatchedDirectories();
 
 public:
     explicit ZDictController(QObject *parent = nullptr);
     ~ZDictController() override;
 
     void setMaxLookupWords(int maxLookupWords);
+    void setIndexCacheDirectory(const QString& path); // empty path disables compiled index cache
+    static void setChunkCacheSize(qint64 bytes); // shared between all dictionaries, 0 disables
+    static ZDictCacheStatistics chunkCacheStatistics();
+    // rendered articles, shared between all dictionaries, separate budget for UTF-16 and UTF-8 articles, 0 disables
+    static void setArticleCacheSize(qint64 bytes);
+    static ZDictCacheStatistics articleCacheStatistics();
+    // latency histograms and counters are collected only while enabled, dictionary metrics are always available
+    static void setMetricsEnabled(bool enable);
+    static void resetMetrics();
+    ZDictMetricsSnapshot metricsSnapshot() const;
+    void setIndexLoading(IndexLoading mode); // call before loadDictionaries
+    void setSubstringIndex(bool enable); // build substring indexes for substringLookup in background
+    // Limit for loaded indexes of all dictionaries, 0 - unlimited. Idle dictionaries over the limit release
+    // their indexes, least recently used first, and load them again on next query.
+    void setMemoryBudget(qint64 bytes);
+    ZDictMemoryStatistics memoryStatistics() const;
     QStringList getLoadedDictionaries() const;
+    QStringList getReadyDictionaries() const;
+    // Repeated calls reload only new and modified dictionaries, unchanged ones are kept loaded
     void loadDictionaries(const QStringList& pathList);
+    void setWatchDirectories(bool enable); // reload automatically on changes in dictionary directories and files
 
     QStringList wordLookup(const QString& word,
                            bool suppressMultiforms = false,
                            int maxLookupWords = defaultMaxLookupWords);
-    void wordLookupAsync(const QString& word,
-                         bool suppressMultiforms = false,
-                         int maxLookupWords = defaultMaxLookupWords);
+    QStringList wordLookupPage(const QString& word,
+                               const QString& startAfter, // last word of the previous page, empty for first page
+                               bool suppressMultiforms = false,
+                               int pageSize = defaultLookupPageSize);
+
+    // Typo-tolerant lookup, words within edit distance from the word, closest first.
+    // Dictionaries stop scanning after timeBudgetMS and return matches found so far.
+    QStringList fuzzyLookup(const QString& word,
+                            int maxDistance = defaultFuzzyDistance,
+                            int maxLookupWords = defaultLookupPageSize,
+                            int timeBudgetMS = defaultFuzzyTimeBudgetMS);
+
+    // Words containing the word, in code point order. Uses substring index when it's ready, full scan otherwise.
+    QStringList substringLookup(const QString& word, int maxLookupWords = defaultLookupPageSize);
+
+    // Batch variants, results are aligned with words
+    QVector<QStringList> wordLookupBatch(const QStringList& words,
+                                         bool suppressMultiforms = false,
+                                         int maxLookupWords = defaultMaxLookupWords);
+    QStringList loadArticleBatch(const QStringList& words, bool addDictionaryName = true);
+
+    // Async requests return request id, passed back with the result signal.
+    // A new request supersedes queued and running requests of the same kind, their results are dropped.
+    // Running fuzzy and substring scans check for supersede and stop early.
+    quint64 wordLookupAsync(const QString& word,
+                            bool suppressMultiforms = false,
+                            int maxLookupWords = defaultMaxLookupWords);
+    quint64 fuzzyLookupAsync(const QString& word,
+                             int maxDistance = defaultFuzzyDistance,
+                             int maxLookupWords = defaultLookupPageSize,
+                             int timeBudgetMS = defaultFuzzyTimeBudgetMS);
+
+    quint64 substringLookupAsync(const QString& word, int maxLookupWords = defaultLookupPageSize);
+
+    // emitSections - emit articleSectionReady for each dictionary section in dictionary order as soon as it's ready
+    QString loadArticle(const QString& word, bool addDictionaryName = true, bool emitSections = false);
+    QByteArray loadArticleUtf8(const QString& word, bool addDictionaryName = true); // UTF-8 HTML for web views and sockets
 
-    QString loadArticle(const QString& word, bool addDictionaryName = true);
-    void loadArticleAsync(const QString& word, bool addDictionaryName = true);
+    // Parsed articles as typed byte segments in dictionary order, rendering is a separate optional stage
+    QVector<ZDictRawArticle> loadRawArticles(const QString& word);
+    static QString renderRawArticle(const ZDictRawArticle& article);
+    static QByteArray renderRawArticleUtf8(const ZDictRawArticle& article);
+    quint64 loadArticleAsync(const QString& word, bool addDictionaryName = true, bool emitSections = false);
 
 Q_SIGNALS:
-    void wordListComplete(const QStringList& words); // cross-thread signal, use queued connect!
-    void articleComplete(const QString& article); // cross-thread signal, use queued connect!
+    void wordListComplete(const QStringList& words, quint64 requestId); // cross-thread signal, use queued connect!
+    void articleComplete(const QString& article, quint64 requestId); // cross-thread signal, use queued connect!
+    void articleSectionReady(const QString& section, quint64 requestId); // cross-thread signal, use queued connect!
     void dictionariesLoaded(const QString& message); // cross-thread signal, use queued connect!
+    void dictionaryReady(const QString& name); // cross-thread signal, use queued connect!
 
 public Q_SLOTS:
     void cancelActiveWork();
+    void reloadDictionaries();
 
 };
 